@@ -1002,6 +1002,12 @@ static int seenHardLink(FileRecords & files, FileListRec flp, rpm_ino_t *fileid)
     return 0;
 }
 
+/* Does the file record get a content digest in the header */
+static int needsDigest(FileListRec flp)
+{
+    return S_ISREG(flp->fl_mode) && !(flp->flags & RPMFILE_GHOST);
+}
+
 /**
  * Add file entries to header.
  * @todo Should directories have %doc/%config attributes? (#14531)
@@ -1102,6 +1108,28 @@ static void genCpioListAndHeader(FileList fl, rpmSpec spec, Package pkg, int isS
     
     pkg->dpaths = (char **)xmalloc((fl->files.size() + 1) * sizeof(*pkg->dpaths));
 
+    /*
+     * Calculate the file digests in parallel upfront. Of duplicate entries
+     * only the last one makes it to the header, skip the others. Flags
+     * only accumulate on merge, so this may calculate some excess
+     * digests but never misses one.
+     */
+    std::vector<std::string> digests(fl->files.size());
+    #pragma omp parallel for schedule(dynamic)
+    for (unsigned ix = 0; ix < fl->files.size(); ix++) {
+	FileListRec dflp = &fl->files[ix];
+	char dbuf[BUFSIZ];
+
+	if (ix < fl->files.size() - 1 && rstreq(dflp->cpioPath, dflp[1].cpioPath))
+	    continue;
+	if ((dflp->flags & RPMFILE_EXCLUDE) || !needsDigest(dflp))
+	    continue;
+
+	dbuf[0] = '\0';
+	(void) rpmDoDigest(digestalgo, dflp->diskPath, 1, (unsigned char *)dbuf);
+	digests[ix] = dbuf;
+    }
+
     /* Generate the header. */
     for (i = 0, flp = fl->files.data(); i < fl->files.size(); i++, flp++) {
 	rpm_ino_t fileid = flp - fl->files.data();
@@ -1232,11 +1260,8 @@ static void genCpioListAndHeader(FileList fl, rpmSpec spec, Package pkg, int isS
 	    headerPutString(h, RPMTAG_FILECAPS, flp->caps);
 	}
 	
-	buf[0] = '\0';
-	if (S_ISREG(flp->fl_mode) && !(flp->flags & RPMFILE_GHOST))
-	    (void) rpmDoDigest(digestalgo, flp->diskPath, 1, 
-			       (unsigned char *)buf);
-	headerPutString(h, RPMTAG_FILEDIGESTS, buf);
+	headerPutString(h, RPMTAG_FILEDIGESTS,
+			needsDigest(flp) ? digests[i].c_str() : "");
 	
 	buf[0] = '\0';
 	if (S_ISLNK(flp->fl_mode)) {
@@ -6,9 +6,11 @@
 #include "system.h"
 
 #include <algorithm>
+#include <thread>
 #include <vector>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <sys/wait.h>
 
@@ -69,6 +71,33 @@ static int rpmPackageFilesArchive(rpmfiles fi, int isSrc,
 
     return rc;
 }
+
+/*
+ * Copy the compressed payload from a pipe into the package. Writing
+ * through fdo updates any digests active on it, so the compressed payload
+ * gets digested without reading it back from the disk.
+ */
+static void teePayload(FD_t pfd, FD_t fdo, rpmRC *rc)
+{
+    std::vector<char> buf(32*BUFSIZ);
+    ssize_t nb;
+
+    while ((nb = Fread(buf.data(), 1, buf.size(), pfd)) > 0) {
+	/* On error, keep draining the pipe to let the compressor finish */
+	if (*rc == RPMRC_OK && Fwrite(buf.data(), 1, nb, fdo) != nb) {
+	    rpmlog(RPMLOG_ERR, _("Unable to write payload to %s: %s\n"),
+		    Fdescr(fdo), Fstrerror(fdo));
+	    *rc = RPMRC_FAIL;
+	}
+    }
+
+    if (nb < 0) {
+	rpmlog(RPMLOG_ERR, _("Unable to read payload: %s\n"), Fstrerror(pfd));
+	*rc = RPMRC_FAIL;
+    }
+    Fclose(pfd);
+}
+
 /**
  * @todo Create transaction set *much* earlier.
  */
@@ -77,13 +106,37 @@ static rpmRC cpio_doio(FD_t fdo, Package pkg, const char * fmodeMacro,
 			char ** pld3)
 {
     char *failedFile = NULL;
-    FD_t cfd;
+    FD_t cfd, pfd, fd;
     int fsmrc;
+    int pipefd[2];
+    rpmRC teerc = RPMRC_OK;
+    std::thread tee;
 
     (void) Fflush(fdo);
-    cfd = Fdopen(fdDup(Fileno(fdo)), fmodeMacro);
-    if (cfd == NULL)
+    if (pipe2(pipefd, O_CLOEXEC)) {
+	rpmlog(RPMLOG_ERR, _("Unable to create pipe: %s\n"), strerror(errno));
+	return RPMRC_FAIL;
+    }
+
+    /*
+     * The compressor writes into a pipe, from where it's copied to fdo.
+     * Wrap the pipe ends as they are to keep them close-on-exec.
+     */
+    fd = fdNew(pipefd[0], NULL);
+    pfd = Fdopen(fd, "r.ufdio");
+    if (pfd == NULL) {
+	Fclose(fd);
+	close(pipefd[1]);
 	return RPMRC_FAIL;
+    }
+    fd = fdNew(pipefd[1], NULL);
+    cfd = Fdopen(fd, fmodeMacro);
+    if (cfd == NULL) {
+	Fclose(fd);
+	Fclose(pfd);
+	return RPMRC_FAIL;
+    }
+    tee = std::thread(teePayload, pfd, fdo, &teerc);
 
     /* Calculate alternative (uncompressed) payload digest while writing */
     fdInitDigestID(cfd, RPM_HASH_SHA256, RPMTAG_PAYLOADSHA256ALT, 0);
@@ -108,8 +161,9 @@ static rpmRC cpio_doio(FD_t fdo, Package pkg, const char * fmodeMacro,
 
     free(failedFile);
     Fclose(cfd);
+    tee.join();
 
-    return (fsmrc == 0) ? RPMRC_OK : RPMRC_FAIL;
+    return (fsmrc == 0 && teerc == RPMRC_OK) ? RPMRC_OK : RPMRC_FAIL;
 }
 
 static rpmRC addFileToTag(rpmSpec spec, const char * file,
@@ -553,10 +607,16 @@ static rpmRC writeRPM(Package pkg, unsigned char ** pkgidp,
     if (writeHdr(fd, pkg->header))
 	goto exit;
 
-    /* Write payload section (cpio archive) */
+    /* Write payload section (cpio archive), digesting it on the way */
     payloadStart = Ftell(fd);
+    fdInitDigestID(fd, RPM_HASH_SHA256, RPMTAG_PAYLOADSHA256, 0);
+    fdInitDigestID(fd, RPM_HASH_SHA512, RPMTAG_PAYLOADSHA512, 0);
+    fdInitDigestID(fd, RPM_HASH_SHA3_256, RPMTAG_PAYLOADSHA3_256, 0);
     if (cpio_doio(fd, pkg, rpmio_flags, &archiveSize, &upld, &upld512, &upld3))
 	goto exit;
+    fdFiniDigest(fd, RPMTAG_PAYLOADSHA256, (void **)&pld, NULL, 1);
+    fdFiniDigest(fd, RPMTAG_PAYLOADSHA512, (void **)&pld512, NULL, 1);
+    fdFiniDigest(fd, RPMTAG_PAYLOADSHA3_256, (void **)&pld3, NULL, 1);
     payloadEnd = Ftell(fd);
     payloadSize = payloadEnd - payloadStart;
 
@@ -572,16 +632,6 @@ static rpmRC writeRPM(Package pkg, unsigned char ** pkgidp,
 	headerDel(pkg->header, RPMTAG_PAYLOADSHA3_256ALT);
     }
 
-    /* Re-read payload to calculate compressed digest */
-    fdInitDigestID(fd, RPM_HASH_SHA256, RPMTAG_PAYLOADSHA256, 0);
-    fdInitDigestID(fd, RPM_HASH_SHA512, RPMTAG_PAYLOADSHA512, 0);
-    fdInitDigestID(fd, RPM_HASH_SHA3_256, RPMTAG_PAYLOADSHA3_256, 0);
-    if (fdConsume(fd, payloadStart, payloadSize))
-	goto exit;
-    fdFiniDigest(fd, RPMTAG_PAYLOADSHA256, (void **)&pld, NULL, 1);
-    fdFiniDigest(fd, RPMTAG_PAYLOADSHA512, (void **)&pld512, NULL, 1);
-    fdFiniDigest(fd, RPMTAG_PAYLOADSHA3_256, (void **)&pld3, NULL, 1);
-
     /* Insert the payload digests + size in main header */
     headerPutString(pkg->header, RPMTAG_PAYLOADSHA256, pld);
     headerPutString(pkg->header, RPMTAG_PAYLOADSHA256ALT, upld);
@@ -598,13 +648,9 @@ static rpmRC writeRPM(Package pkg, unsigned char ** pkgidp,
     pld512 = _free(pld512);
     pld3 = _free(pld3);
 
-    /* Write the final header */
+    /* Write the final header, calculating the digests on the way */
     if (fdJump(fd, hdrStart))
 	goto exit;
-    if (writeHdr(fd, pkg->header))
-	goto exit;
-
-    /* Calculate the digests */
     if (rpmformat < 6) {
 	/* SHA1 and legacy MD5 on header + payload only in v4 */
 	fdInitDigestID(fd, RPM_HASH_MD5, RPMTAG_SIGMD5, 0);
@@ -613,15 +659,18 @@ static rpmRC writeRPM(Package pkg, unsigned char ** pkgidp,
 	fdInitDigestID(fd, RPM_HASH_SHA3_256, RPMTAG_SHA3_256HEADER, 0);
     }
     fdInitDigestID(fd, RPM_HASH_SHA256, RPMTAG_SHA256HEADER, 0);
-    if (fdConsume(fd, hdrStart, payloadStart - hdrStart))
+    if (writeHdr(fd, pkg->header))
 	goto exit;
     fdFiniDigest(fd, RPMTAG_SHA1HEADER, (void **)&SHA1, NULL, 1);
     fdFiniDigest(fd, RPMTAG_SHA256HEADER, (void **)&SHA256, NULL, 1);
     fdFiniDigest(fd, RPMTAG_SHA3_256HEADER, (void **)&SHA3_256, NULL, 1);
 
-    if (fdConsume(fd, 0, payloadSize))
-	goto exit;
-    fdFiniDigest(fd, RPMTAG_SIGMD5, (void **)&MD5, NULL, 0);
+    /* The legacy MD5 covers the payload too, which still needs a re-read */
+    if (rpmformat < 6) {
+	if (fdConsume(fd, 0, payloadSize))
+	    goto exit;
+	fdFiniDigest(fd, RPMTAG_SIGMD5, (void **)&MD5, NULL, 0);
+    }
 
     if (fdJump(fd, sigStart))
 	goto exit;
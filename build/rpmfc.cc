@@ -8,6 +8,7 @@
 #include <sys/wait.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <spawn.h>
 #include <magic.h>
 #include <regex.h>
 #ifdef HAVE_LIBELF
@@ -268,65 +269,81 @@ static int getOutputFrom(ARGV_t argv,
     int myerrno = 0;
     int ret = 1; /* assume failure */
     int doio = (writePtr || sb_stdout);
-
-    if (doio && (pipe(toProg) < 0 || pipe(fromProg) < 0)) {
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t sigdef;
+    ARGV_t envp = NULL;
+    int xx;
+
+    /* Don't leak the pipes to generators running concurrently */
+    if (doio && (pipe2(toProg, O_CLOEXEC) < 0 || pipe2(fromProg, O_CLOEXEC) < 0)) {
 	rpmlog(RPMLOG_ERR, _("Couldn't create pipe for %s: %m\n"), argv[0]);
 	return -1;
     }
-    
-    struct sigaction act, oact;
-    memset(&act, 0, sizeof(act));
-    act.sa_handler = SIG_IGN;
-    sigaction(SIGPIPE, &act, &oact);
 
-    child = fork();
-    if (child < 0) {
-	rpmlog(RPMLOG_ERR, _("Couldn't fork %s: %s\n"),
-		argv[0], strerror(errno));
-	if (doio) {
-	    close(toProg[1]);
-	    close(toProg[0]);
-	    close(fromProg[0]);
-	    close(fromProg[1]);
-	}
-	ret = -1;
-	goto exit;
+    /*
+     * The generators run from concurrent threads, so don't fork and run
+     * code in the child (rpmlog() locks, setenv()) but spawn the helper
+     * with everything prepared here.
+     */
+    for (char **e = environ; e && *e; e++) {
+	if (rstreqn(*e, "DEBUGINFOD_URLS=", 16))
+	    continue;
+	if (!buildRoot.empty() && rstreqn(*e, "RPM_BUILD_ROOT=", 15))
+	    continue;
+	argvAdd(&envp, *e);
+    }
+    if (!buildRoot.empty()) {
+	char *br = rstrscat(NULL, "RPM_BUILD_ROOT=", buildRoot.c_str(), NULL);
+	argvAdd(&envp, br);
+	free(br);
     }
-    if (child == 0) {
-	act.sa_handler = SIG_DFL;
-	sigaction(SIGPIPE, &act, NULL);
 
-	close(toProg[1]);
-	close(fromProg[0]);
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&fa);
 
+    /* The caller ignores SIGPIPE, don't pass that on to the helper */
+    sigemptyset(&sigdef);
+    sigaddset(&sigdef, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &sigdef);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+    if (doio) {
 	/*
 	 * When expecting input, make stdin the in pipe as you'd normally do.
 	 * Otherwise pass stdout(!) as the in pipe to cause reads to error
 	 * out. Just closing the fd breaks some software (eg libtool).
+	 * The other pipe ends are close-on-exec.
 	 */
-	if (writePtr) {
-	    dup2(toProg[0], STDIN_FILENO);
-	    close(toProg[0]);
-	} else {
-	    dup2(fromProg[1], STDIN_FILENO);
-	}
-
-	dup2(fromProg[1], STDOUT_FILENO); /* Make stdout the out pipe */
-	close(fromProg[1]);
-
-	rpmlog(RPMLOG_DEBUG, "\texecv(%s) pid %d\n",
-                        argv[0], (unsigned)getpid());
+	if (writePtr)
+	    posix_spawn_file_actions_adddup2(&fa, toProg[0], STDIN_FILENO);
+	else
+	    posix_spawn_file_actions_adddup2(&fa, fromProg[1], STDIN_FILENO);
+	/* Make stdout the out pipe */
+	posix_spawn_file_actions_adddup2(&fa, fromProg[1], STDOUT_FILENO);
+    }
 
-	unsetenv("DEBUGINFOD_URLS");
-	if (!buildRoot.empty())
-	    setenv("RPM_BUILD_ROOT", buildRoot.c_str(), 1);
+    xx = posix_spawnp(&child, argv[0], &fa, &attr, argv, envp);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    argvFree(envp);
 
-	execvp(argv[0], (char *const *)argv);
+    if (xx) {
 	rpmlog(RPMLOG_ERR, _("Couldn't exec %s: %s\n"),
-		argv[0], strerror(errno));
-	_exit(EXIT_FAILURE);
+		argv[0], strerror(xx));
+	if (doio) {
+	    close(toProg[1]);
+	    close(toProg[0]);
+	    close(fromProg[0]);
+	    close(fromProg[1]);
+	}
+	ret = -1;
+	goto exit;
     }
 
+    rpmlog(RPMLOG_DEBUG, "\texecv(%s) pid %d\n",
+		argv[0], (unsigned)child);
+
     if (!doio)
 	goto reap;
 
@@ -433,11 +450,15 @@ reap:
     ret = 0;
 
 exit:
-    sigaction(SIGPIPE, &oact, NULL);
     return ret;
 }
 
-int rpmfcExec(ARGV_const_t av, StringBuf sb_stdin, StringBuf * sb_stdoutp,
+/*
+ * Run a helper with SIGPIPE already ignored by the caller. The generators
+ * run from concurrent tasks, saving and restoring the disposition per
+ * helper would race there.
+ */
+static int doExec(ARGV_const_t av, StringBuf sb_stdin, StringBuf * sb_stdoutp,
 		int failnonzero, const string & buildRoot)
 {
     char * s = NULL;
@@ -503,6 +524,22 @@ exit:
     return ec;
 }
 
+int rpmfcExec(ARGV_const_t av, StringBuf sb_stdin, StringBuf * sb_stdoutp,
+		int failnonzero, const string & buildRoot)
+{
+    struct sigaction act, oact;
+    int ec;
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &act, &oact);
+
+    ec = doExec(av, sb_stdin, sb_stdoutp, failnonzero, buildRoot);
+
+    sigaction(SIGPIPE, &oact, NULL);
+    return ec;
+}
+
 static void argvAddUniq(ARGV_t * argvp, const char * key)
 {
     if (argvSearch(*argvp, key, NULL) == NULL) {
@@ -519,7 +556,8 @@ static void rpmfcAddFileDep(rpmfcFileDeps & fileDeps, rpmds ds, int ix)
     fileDeps.push_back(dep);
 }
 
-static ARGV_t runCmd(const char *name, const string & buildRoot, ARGV_t fns)
+static ARGV_t runCmd(const char *name, const string & buildRoot, ARGV_t fns,
+		     int keepEmpty)
 {
     ARGV_t output = NULL;
     ARGV_t av = NULL;
@@ -531,8 +569,11 @@ static ARGV_t runCmd(const char *name, const string & buildRoot, ARGV_t fns)
 
     for (ARGV_t fn = fns; fn && *fn; fn++)
 	appendLineStringBuf(sb_stdin, *fn);
-    if (rpmfcExec(av, sb_stdin, &sb_stdout, 0, buildRoot) == 0) {
-	argvSplit(&output, getStringBuf(sb_stdout), "\n\r");
+    if (doExec(av, sb_stdin, &sb_stdout, 0, buildRoot) == 0) {
+	if (keepEmpty)
+	    output = argvSplitString(getStringBuf(sb_stdout), "\n", ARGV_NONE);
+	else
+	    argvSplit(&output, getStringBuf(sb_stdout), "\n\r");
     }
 
     argvFree(av);
@@ -574,6 +615,7 @@ struct addReqProvDataFc {
     rpmfc fc;
     const char *namespc;
     regex_t *exclude;
+    rpmfcFileDeps *fileDeps;
 };
 
 static rpmRC addReqProvFc(void *cbdata, rpmTagVal tagN,
@@ -588,7 +630,7 @@ static rpmRC addReqProvFc(void *cbdata, rpmTagVal tagN,
     rpmds ds = rpmdsSingleNS(fc->pool, tagN, namespc, N, EVR, Flags);
     /* Add to package and file dependencies unless filtered */
     if (regMatch(exclude, rpmdsDNEVR(ds)+2) == 0)
-	rpmfcAddFileDep(fc->fileDeps, ds, index);
+	rpmfcAddFileDep(*data->fileDeps, ds, index);
 
     return RPMRC_OK;
 }
@@ -614,22 +656,48 @@ static void exclFini(struct exclreg_s *excl)
     memset(excl, 0, sizeof(*excl));
 }
 
-static int genDeps(const char *mname, int multifile, rpmTagVal tagN,
+enum genProto {
+    GENPROTO_SINGLEFILE	= 0,
+    GENPROTO_MULTIFILE	= 1,
+    GENPROTO_SERVER	= 2,
+};
+
+static int genDeps(const char *mname, int proto, rpmTagVal tagN,
 		rpmsenseFlags dsContext, struct addReqProvDataFc *data,
 		int *fnx, int nfn, int fx, ARGV_t paths)
 {
     rpmfc fc = data->fc;
     ARGV_t pav = NULL;
+    int pac;
     int rc = 0;
 
     if (rpmMacroIsParametric(NULL, mname)) {
 	pav = runCall(mname, fc->buildRoot, paths);
     } else {
-	pav = runCmd(mname, fc->buildRoot, paths);
+	pav = runCmd(mname, fc->buildRoot, paths, (proto == GENPROTO_SERVER));
     }
 
-    for (int px = 0, pac = argvCount(pav); px < pac; px++) {
-	if (multifile && *pav[px] == ';') {
+    pac = argvCount(pav);
+    /* Ignore the empty string after the last newline */
+    if (proto == GENPROTO_SERVER && pac > 0 && *pav[pac-1] == '\0')
+	pac--;
+
+    for (int px = 0; px < pac; px++) {
+	if (proto == GENPROTO_SERVER) {
+	    if (fx >= nfn) {
+		rpmlog(RPMLOG_ERR,
+			_("unexpected output from generator: %s\n"), pav[px]);
+		rc++;
+		break;
+	    }
+	    /* An empty line terminates the output for the current file */
+	    if (*pav[px] == '\0') {
+		fx++;
+		continue;
+	    }
+	}
+
+	if (proto == GENPROTO_MULTIFILE && *pav[px] == ';') {
 	    int found = 0;
 	    /* Look forward to allow generators to omit files without deps */
 	    do {
@@ -653,6 +721,12 @@ static int genDeps(const char *mname, int multifile, rpmTagVal tagN,
 	    rc++;
 	}
     }
+
+    if (proto == GENPROTO_SERVER && rc == 0 && fx < nfn) {
+	rpmlog(RPMLOG_ERR, _("missing output from generator %s for %s\n"),
+		mname, paths[fx]);
+	rc++;
+    }
     argvFree(pav);
 
     return rc;
@@ -661,28 +735,36 @@ static int genDeps(const char *mname, int multifile, rpmTagVal tagN,
 static int rpmfcHelper(rpmfc fc, int *fnx, int nfn, const char *proto,
 		       const struct exclreg_s *excl,
 		       rpmsenseFlags dsContext, rpmTagVal tagN,
-		       const char *namespc, const char *mname)
+		       const char *namespc, const char *mname,
+		       rpmfcFileDeps *fileDeps)
 {
     int rc = 0;
     struct addReqProvDataFc data;
     data.fc = fc;
     data.namespc = namespc;
     data.exclude = excl->exclude;
+    data.fileDeps = fileDeps;
 
-    if (rstreq(proto, "multifile")) {
+    /* There's no process to keep around for parametric macros */
+    if (rstreq(proto, "server") && rpmMacroIsParametric(NULL, mname))
+	proto = "singlefile";
+
+    if (rstreq(proto, "multifile") || rstreq(proto, "server")) {
+	int multifile = rstreq(proto, "multifile");
 	const char **paths = (const char **)xcalloc(nfn + 1, sizeof(*paths));
 	for (int i = 0; i < nfn; i++)
 	    paths[i] = fc->fn[fnx[i]].c_str();
 	paths[nfn] = NULL;
-	rc = genDeps(mname, 1, tagN, dsContext, &data,
-			fnx, nfn, -1, (ARGV_t) paths);
+	rc = genDeps(mname, multifile ? GENPROTO_MULTIFILE : GENPROTO_SERVER,
+			tagN, dsContext, &data,
+			fnx, nfn, multifile ? -1 : 0, (ARGV_t) paths);
 	free(paths);
     } else if (rstreq(proto, "singlefile")) {
 	for (int i = 0; i < nfn; i++) {
 	    const char *fn = fc->fn[fnx[i]].c_str();
 	    const char *paths[] = { fn, NULL };
 
-	    rc += genDeps(mname, 0, tagN, dsContext, &data,
+	    rc += genDeps(mname, GENPROTO_SINGLEFILE, tagN, dsContext, &data,
 			fnx, nfn, i, (ARGV_t) paths);
 	}
     } else {
@@ -1038,7 +1120,8 @@ static const struct applyDep_s applyDepTable[] = {
 static int applyAttr(rpmfc fc, int aix,
 			const struct rpmfcAttr_s *attr,
 			const struct exclreg_s *excl,
-			const struct applyDep_s *dep)
+			const struct applyDep_s *dep,
+			rpmfcFileDeps *fileDeps)
 {
     int rc = 0;
 
@@ -1066,7 +1149,7 @@ static int applyAttr(rpmfc fc, int aix,
 	    /* Sort for reproducibility - hashmap was constructed in parallel */
 	    std::sort(fnx.begin(), fnx.end());
 	    rc = rpmfcHelper(fc, fnx.data(), fnx.size(), attr->proto,
-			    excl, dep->type, dep->tag, ns, mname);
+			    excl, dep->type, dep->tag, ns, mname, fileDeps);
 	    free(ns);
 	}
 	free(mname);
@@ -1074,6 +1157,15 @@ static int applyAttr(rpmfc fc, int aix,
     return rc;
 }
 
+struct applyJob_s {
+    const struct applyDep_s *dep;
+    int aix;
+    rpmfcAttr attr;
+    const struct exclreg_s *excl;
+    rpmfcFileDeps fileDeps;
+    int rc;
+};
+
 static rpmRC rpmfcApplyInternal(rpmfc fc)
 {
     rpmRC rc = RPMRC_OK;
@@ -1083,32 +1175,76 @@ static rpmRC rpmfcApplyInternal(rpmfc fc)
     int ix;
     const struct applyDep_s *dep;
     int skip = 0;
-    struct exclreg_s excl;
+    vector<struct exclreg_s> excls;
+    vector<struct applyJob_s> jobs;
+    struct sigaction act, oact;
 
     if (fc->skipProv)
 	skip |= RPMSENSE_FIND_PROVIDES;
     if (fc->skipReq)
 	skip |= RPMSENSE_FIND_REQUIRES;
 
-    /* Generate package and per-file dependencies. */
+    for (dep = applyDepTable; dep->tag; dep++)
+	excls.push_back({});
+
     for (dep = applyDepTable; dep->tag; dep++) {
 	int aix = 0;
 	if (skip & dep->type)
 	    continue;
-	exclInit(dep->name, &excl);
+	exclInit(dep->name, &excls[dep - applyDepTable]);
 	for (auto const & attr : fc->atypes) {
-	    if (applyAttr(fc, aix++, attr, &excl, dep))
-		rc = RPMRC_FAIL;
+	    jobs.push_back({ dep, aix++, attr, &excls[dep - applyDepTable] });
 	}
-	exclFini(&excl);
     }
+
+    /*
+     * Generate package and per-file dependencies, running the generators
+     * concurrently. The results are collected per generator and merged
+     * in the usual order afterwards, for reproducibility. SIGPIPE is
+     * ignored once for the whole run, see doExec().
+     */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &act, &oact);
+
+    #pragma omp parallel
+    #pragma omp single
+    for (size_t i = 0; i < jobs.size(); i++) {
+	#pragma omp task untied
+	{
+	struct applyJob_s *job = &jobs[i];
+	job->rc = applyAttr(fc, job->aix, job->attr, job->excl, job->dep,
+			    &job->fileDeps);
+	} /* omp task */
+    }
+
+    sigaction(SIGPIPE, &oact, NULL);
+
+    for (auto & job : jobs) {
+	if (job.rc)
+	    rc = RPMRC_FAIL;
+	fc->fileDeps.insert(fc->fileDeps.end(),
+			    job.fileDeps.begin(), job.fileDeps.end());
+    }
+    for (auto & excl : excls)
+	exclFini(&excl);
     /* No more additions after this, freeze pool to minimize memory use */
 
     rpmfcNormalizeFDeps(fc);
+
+    /* Merge the file dependencies into the package, a batch per type */
+    std::vector<std::pair<rpmTagVal,std::vector<rpmds>>> batches;
     for (auto const & fdep : fc->fileDeps) {
-	rpmds ds = fdep.dep;
-	rpmdsMerge(packageDependencies(fc->pkg, rpmdsTagN(ds)), ds);
+	rpmTagVal tagN = rpmdsTagN(fdep.dep);
+	auto batch = std::find_if(batches.begin(), batches.end(),
+				  [tagN](auto const & b) { return b.first == tagN; });
+	if (batch == batches.end())
+	    batch = batches.insert(batches.end(), {tagN, {}});
+	batch->second.push_back(fdep.dep);
     }
+    for (auto & [tagN, deps] : batches)
+	rpmdsMergeAll(packageDependencies(fc->pkg, tagN),
+		      deps.data(), deps.size());
 
     /* Sort by index */
     std::sort(fc->fileDeps.begin(), fc->fileDeps.end());
@@ -262,6 +262,38 @@ int headerDel(Header h, rpmTagVal tag);
  */
 char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg);
 
+/** \ingroup header
+ * Compile a rpm-queryformat(7) string for formatting many headers.
+ * The format is only parsed once, and the output buffer is reused
+ * between calls to headerFormatterRender(). A formatter must not be
+ * used from more than one thread at a time.
+ *
+ * @param fmt		format to use
+ * @param[out] errmsg	error message (if any)
+ * @return		compiled format, NULL on error
+ */
+headerFormatter headerFormatterNew(const char * fmt, errmsg_t * errmsg);
+
+/** \ingroup header
+ * Destroy a compiled query format.
+ * @param hf		compiled format
+ * @return		NULL always
+ */
+headerFormatter headerFormatterFree(headerFormatter hf);
+
+/** \ingroup header
+ * Return output formatted according to a compiled query format.
+ * The returned string is owned by the formatter, and valid until the
+ * next call on it.
+ *
+ * @param hf		compiled format
+ * @param h		header
+ * @param[out] errmsg	error message (if any)
+ * @return		formatted output string, NULL on error
+ */
+const char * headerFormatterRender(headerFormatter hf, Header h,
+				   errmsg_t * errmsg);
+
 /** \ingroup header
  * Duplicate tag values from one header into another.
  * @param headerFrom	source header
@@ -180,6 +180,8 @@ struct rpmQVKArguments_s {
 		- 'I'	from --import
 		- 'K'	from --checksig, -K
 		*/
+    headerFormatter qva_formatter;
+		/*!< Compiled qva_queryFormat, set up by rpmcliQuery(). */
 };
 
 /** \ingroup rpmcli
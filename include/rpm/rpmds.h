@@ -352,6 +352,17 @@ int rpmdsFind(rpmds ds, const rpmds ods);
  */
 int rpmdsMerge(rpmds * dsp, rpmds ods);
 
+/** \ingroup rpmds
+ * Merge several dependency sets maintaining (N,EVR,Flags) sorted order.
+ * Unlike merging the sets one by one, the new elements are sorted once
+ * and merged in a single pass, which is much faster for big sets.
+ * @param[out] *dsp	(merged) dependency set
+ * @param odsv		array of dependency sets to merge
+ * @param nods		number of dependency sets in the array
+ * @return		number of merged dependencies, -1 on error
+ */
+int rpmdsMergeAll(rpmds * dsp, rpmds * odsv, int nods);
+
 /** \ingroup rpmds
  * Search a sorted dependency set for an element that overlaps.
  * A boolean result is saved (if allocated) and accessible through
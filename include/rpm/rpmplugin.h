@@ -60,6 +60,7 @@ typedef rpmRC (*plugin_fsm_file_prepare_func)(rpmPlugin plugin, rpmfi fi,
 					      int fd, const char* path,
 					      const char *dest,
 					      mode_t file_mode, rpmFsmOp op);
+typedef rpmRC (*plugin_tsm_stats_func)(rpmPlugin plugin, rpmts ts, int res);
 
 typedef struct rpmPluginHooks_s * rpmPluginHooks;
 struct rpmPluginHooks_s {
@@ -82,6 +83,19 @@ struct rpmPluginHooks_s {
     plugin_fsm_file_prepare_func	fsm_file_prepare;
 };
 
+/*
+ * Hooks added after the rpmPluginHooks_s layout was frozen. Plugins
+ * implementing any of these export them as <name>_hooks_ext in addition
+ * to <name>_hooks, with size set to sizeof(struct rpmPluginHooksExt_s).
+ * Only the hooks within size are used, so new ones can be appended.
+ */
+typedef struct rpmPluginHooksExt_s * rpmPluginHooksExt;
+struct rpmPluginHooksExt_s {
+    size_t				size;
+    /* transaction statistics hook */
+    plugin_tsm_stats_func		tsm_stats;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
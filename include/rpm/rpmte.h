@@ -7,6 +7,7 @@
  */
 
 #include <rpm/rpmtypes.h>
+#include <rpm/rpmsw.h>
 #include <rpm/argv.h>
 
 #ifdef __cplusplus
@@ -281,6 +282,15 @@ int rpmteVfyLevel(rpmte te);
  */
 int rpmteSetVfyLevel(rpmte te, int vfylevel);
 
+/** \ingroup rpmte
+ * Retrieve operation timestamp from a transaction element. These cover
+ * the part of the transaction set operations spent on the element.
+ * @param te		transaction element
+ * @param opx		operation timestamp index
+ * @return		pointer to operation timestamp.
+ */
+rpmop rpmteOp(rpmte te, rpmtsOpX opx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -170,30 +170,6 @@ enum {
 #define RPMSIG_VERIFIABLE_TYPE (RPMSIG_DIGEST_TYPE|RPMSIG_SIGNATURE_TYPE)
 #define RPMSIG_UNVERIFIED_TYPE 	(1 << 30)
 
-/** \ingroup rpmts
- * Indices for timestamps.
- */
-typedef	enum rpmtsOpX_e {
-    RPMTS_OP_TOTAL		=  0,
-    RPMTS_OP_CHECK		=  1,
-    RPMTS_OP_ORDER		=  2,
-    RPMTS_OP_FINGERPRINT	=  3,
-    RPMTS_OP_INSTALL		=  5,
-    RPMTS_OP_ERASE		=  6,
-    RPMTS_OP_SCRIPTLETS		=  7,
-    RPMTS_OP_COMPRESS		=  8,
-    RPMTS_OP_UNCOMPRESS		=  9,
-    RPMTS_OP_DIGEST		= 10,
-    RPMTS_OP_SIGNATURE		= 11,
-    RPMTS_OP_DBADD		= 12,
-    RPMTS_OP_DBREMOVE		= 13,
-    RPMTS_OP_DBGET		= 14,
-    RPMTS_OP_DBPUT		= 15,
-    RPMTS_OP_DBDEL		= 16,
-    RPMTS_OP_VERIFY		= 17,
-    RPMTS_OP_MAX		= 18
-} rpmtsOpX;
-
 enum rpmtxnFlags_e {
     RPMTXN_READ		= (1 << 0),
     RPMTXN_WRITE	= (1 << 1),
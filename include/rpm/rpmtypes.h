@@ -23,6 +23,7 @@ typedef const char *    errmsg_t;
  */
 typedef struct headerToken_s * Header;
 typedef struct headerIterator_s * HeaderIterator;
+typedef struct headerFormatter_s * headerFormatter;
 
 typedef uint32_t	rpm_tag_t;
 typedef uint32_t	rpm_tagtype_t;
@@ -110,6 +111,32 @@ typedef	enum rpmRC_e {
     RPMRC_NOKEY		= 4	/*!< Public key is unavailable. */
 } rpmRC;
 
+/** \ingroup rpmts
+ * Indices for timestamps.
+ */
+typedef	enum rpmtsOpX_e {
+    RPMTS_OP_TOTAL		=  0,
+    RPMTS_OP_CHECK		=  1,
+    RPMTS_OP_ORDER		=  2,
+    RPMTS_OP_FINGERPRINT	=  3,
+    RPMTS_OP_INSTALL		=  5,
+    RPMTS_OP_ERASE		=  6,
+    RPMTS_OP_SCRIPTLETS		=  7,
+    RPMTS_OP_COMPRESS		=  8,
+    RPMTS_OP_UNCOMPRESS		=  9,
+    RPMTS_OP_DIGEST		= 10,
+    RPMTS_OP_SIGNATURE		= 11,
+    RPMTS_OP_DBADD		= 12,
+    RPMTS_OP_DBREMOVE		= 13,
+    RPMTS_OP_DBGET		= 14,
+    RPMTS_OP_DBPUT		= 15,
+    RPMTS_OP_DBDEL		= 16,
+    RPMTS_OP_VERIFY		= 17,
+    RPMTS_OP_FSYNC		= 18,	/*!< fsync() and syncfs() calls on installed files */
+    RPMTS_OP_FILES		= 19,	/*!< count and bytes of files created */
+    RPMTS_OP_MAX		= 20
+} rpmtsOpX;
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,9 +8,6 @@
 #include "dbiset.hh"
 #include <rpm/rpmtag.h>
 
-/* XXX: make this backend-specific, eliminate or something... */
-#define	_USE_COPY_LOAD
-
 enum rpmdbFlags {
     RPMDB_FLAG_JUSTCHECK	= (1 << 0),
     RPMDB_FLAG_REBUILD		= (1 << 1),
@@ -24,7 +21,9 @@ typedef enum dbCtrlOp_e {
     DB_CTRL_UNLOCK_RO		= 2,
     DB_CTRL_LOCK_RW		= 3,
     DB_CTRL_UNLOCK_RW		= 4,
-    DB_CTRL_INDEXSYNC		= 5
+    DB_CTRL_INDEXSYNC		= 5,
+    DB_CTRL_BATCH_BEGIN		= 6,
+    DB_CTRL_BATCH_COMMIT	= 7,
 } dbCtrlOp;
 
 struct dbiCursor_s {
@@ -60,6 +59,9 @@ struct rpmdb_s {
     int		db_ndbi;	/*!< No. of tag indices. */
     dbiIndex 	* db_indexes;	/*!< Tag indices. */
     int		db_buildindex;	/*!< Index rebuild indicator */
+    int		db_batch;	/*!< Max. packages per commit (0 if not batching) */
+    int		db_batched;	/*!< Packages in the current batch */
+    int		db_batcherr;	/*!< Intermediate batch commit failed? */
 
     const struct rpmdbOps_s * db_ops;	/*!< backend ops */
 
@@ -85,6 +87,7 @@ enum dbiFlags_e {
     DBI_NONE		= 0,
     DBI_CREATED		= (1 << 0),
     DBI_RDONLY		= (1 << 1),
+    DBI_BLOBCOPY	= (1 << 2),	/*!< pkgdbGet() blobs are owned by the caller */
 };
 
 enum dbcFlags_e {
@@ -32,10 +32,6 @@ struct ndbEnv_s {
     rpmxdb xdb;
     int refs;
     int dofsync;
-
-    unsigned int hdrNum;
-    void *data;
-    unsigned int datalen;
 };
 
 static void closeEnv(rpmdb rdb)
@@ -50,8 +46,6 @@ static void closeEnv(rpmdb rdb)
 	    rpmpkgClose(ndbenv->pkgdb);
 	    rpmlog(RPMLOG_DEBUG, "closed   db index       %s/Packages.db\n", rpmdbHome(rdb));
 	}
-	if (ndbenv->data)
-	    free(ndbenv->data);
 	delete ndbenv;
 	rdb->db_dbenv = 0;
     }
@@ -146,6 +140,8 @@ static int ndb_Open(rpmdb rdb, rpmDbiTagVal rpmtag, dbiIndex * dbip, int flags)
 	}
 	free(path);
 	dbi->dbi_db = ndbenv->pkgdb = pkgdb;
+	/* Blobs are read into (or copied from a mapping to) a new buffer */
+	dbi->dbi_flags |= DBI_BLOBCOPY;
 	rpmpkgSetFsync(pkgdb, ndbenv->dofsync);
     } else {
 	unsigned int id;
@@ -310,36 +306,20 @@ static dbiCursor ndb_CursorFree(dbiIndex dbi, dbiCursor _dbc)
 }
 
 
-static void setdata(ndb_cursor *dbc,  unsigned int hdrNum, unsigned char *hdrBlob, unsigned int hdrLen)
-{
-    struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)dbc->dbi->dbi_rpmdb->db_dbenv;
-    if (ndbenv->data)
-	free(ndbenv->data);
-    ndbenv->hdrNum  = hdrNum;
-    ndbenv->data    = hdrBlob;
-    ndbenv->datalen = hdrLen;
-}
-
 static rpmRC ndb_pkgdbPut(dbiIndex dbi, dbiCursor _dbc,  unsigned int *hdrNum, unsigned char *hdrBlob, unsigned int hdrLen)
 {
     ndb_cursor *dbc = static_cast<ndb_cursor *>(_dbc);
-    struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)dbc->dbi->dbi_rpmdb->db_dbenv;
     unsigned int hnum = *hdrNum;
     rpmRC rc = RPMRC_OK;
 
-    if (hnum == 0) {
+    if (hnum == 0)
 	rc = rpmpkgNextPkgIdx((rpmpkgdb)dbc->dbi->dbi_db, &hnum);
-	if (!rc && ndbenv->hdrNum == hnum)
-	    setdata(dbc, hnum, 0, 0);
-    }
 
     if (!rc)
 	rc = rpmpkgPut((rpmpkgdb)dbc->dbi->dbi_db, hnum, hdrBlob, hdrLen);
 
     if (!rc) {
 	dbc->hdrNum = hnum;
-	if (ndbenv->hdrNum == hnum)
-	    setdata(dbc, hnum, 0, 0);
 	*hdrNum = hnum;
     }
     return rc;
@@ -348,14 +328,11 @@ static rpmRC ndb_pkgdbPut(dbiIndex dbi, dbiCursor _dbc,  unsigned int *hdrNum, u
 static rpmRC ndb_pkgdbDel(dbiIndex dbi, dbiCursor _dbc,  unsigned int hdrNum)
 {
     ndb_cursor *dbc = static_cast<ndb_cursor *>(_dbc);
-    struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)dbc->dbi->dbi_rpmdb->db_dbenv;
     dbc->hdrNum = 0;
-    if (ndbenv->hdrNum == hdrNum)
-	setdata(dbc, 0, 0, 0);
     return rpmpkgDel((rpmpkgdb)dbc->dbi->dbi_db, hdrNum);
 }
 
-/* iterate over all packages */
+/* iterate over all packages, the returned blobs are owned by the caller */
 static rpmRC ndb_pkgdbIter(dbiIndex dbi, dbiCursor _dbc, unsigned char **hdrBlob, unsigned int *hdrLen)
 {
     ndb_cursor *dbc = static_cast<ndb_cursor *>(_dbc);
@@ -381,7 +358,6 @@ static rpmRC ndb_pkgdbIter(dbiIndex dbi, dbiCursor _dbc, unsigned char **hdrBlob
 	dbc->ilist++;
 	if (!rc) {
 	    dbc->hdrNum = hdrNum;
-	    setdata(dbc, hdrNum, *hdrBlob, *hdrLen);
 	    break;
 	}
     }
@@ -392,20 +368,12 @@ static rpmRC ndb_pkgdbGet(dbiIndex dbi, dbiCursor _dbc, unsigned int hdrNum, uns
 {
     rpmRC rc;
     ndb_cursor *dbc = static_cast<ndb_cursor *>(_dbc);
-    struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)dbc->dbi->dbi_rpmdb->db_dbenv;
 
     if (!hdrNum)
 	return ndb_pkgdbIter(dbi, dbc, hdrBlob, hdrLen);
-    if (hdrNum == ndbenv->hdrNum && ndbenv->data) {
-	*hdrBlob = (unsigned char *)ndbenv->data;
-	*hdrLen = ndbenv->datalen;
-	return RPMRC_OK;
-    }
     rc = rpmpkgGet((rpmpkgdb)dbc->dbi->dbi_db, hdrNum, hdrBlob, hdrLen);
-    if (!rc) {
+    if (!rc)
 	dbc->hdrNum = hdrNum;
-	setdata(dbc, hdrNum, *hdrBlob, *hdrLen);
-    }
     return rc;
 }
 
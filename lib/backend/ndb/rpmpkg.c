@@ -5,6 +5,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -49,6 +50,10 @@ struct rpmpkgdb_s {
     char *filename;
     unsigned int fileblks;	/* file size in blks */
     int dofsync;
+
+    unsigned char *map;		/* read-only mapping of the file */
+    size_t mapsize;		/* size of the mapping */
+    int nomap;			/* mapping failed, use pread */
 };
 
 
@@ -582,9 +587,78 @@ static int rpmpkgReadBlob(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned int blko
     return RPMRC_OK;
 }
 
+/* Return the blks in the read-only mapping of the file, or NULL if not mapped.
+ * The caller must hold a lock, the slots guarantee the blks are inside the
+ * file which cannot shrink under a lock */
+static unsigned char *rpmpkgMapBlks(rpmpkgdb pkgdb, unsigned int blkoff, unsigned int blkcnt)
+{
+    size_t need = ((size_t)blkoff + blkcnt) * BLK_SIZE;
+
+    if (!pkgdb->rdonly || pkgdb->nomap)
+	return NULL;
+    if (need > pkgdb->mapsize) {
+	struct stat stb;
+	void *map;
+
+	/* the file grew since we mapped it */
+	if (pkgdb->map)
+	    munmap(pkgdb->map, pkgdb->mapsize);
+	pkgdb->map = 0;
+	pkgdb->mapsize = 0;
+	if (fstat(pkgdb->fd, &stb) || (size_t)stb.st_size < need)
+	    return NULL;
+	map = mmap(NULL, stb.st_size, PROT_READ, MAP_SHARED, pkgdb->fd, 0);
+	if (map == MAP_FAILED) {
+	    pkgdb->nomap = 1;
+	    return NULL;
+	}
+	pkgdb->map = map;
+	pkgdb->mapsize = stb.st_size;
+    }
+    return pkgdb->map + (size_t)blkoff * BLK_SIZE;
+}
+
+/* Like rpmpkgReadBlob, but check the blob in place in the mapping and
+ * return a pointer to its data */
+static int rpmpkgCheckMappedBlob(unsigned char *blks, unsigned int pkgidx, unsigned int blkcnt, unsigned char **blobp, unsigned int *bloblp, unsigned int *generationp, int verifyadler)
+{
+    unsigned int bloblen, generation;
+    unsigned char *tail;
+
+    /* sanity */
+    if (blkcnt <  (BLOBHEAD_SIZE + BLOBTAIL_SIZE + BLK_SIZE - 1) / BLK_SIZE)
+	return RPMRC_FAIL;	/* blkcnt too small */
+    if (le2h(blks) != BLOBHEAD_MAGIC)
+	return RPMRC_FAIL;	/* bad blob */
+    if (le2h(blks + 4) != pkgidx)
+	return RPMRC_FAIL;	/* bad blob */
+    generation = le2h(blks + 8);
+    bloblen = le2h(blks + 12);
+    if (blkcnt != (BLOBHEAD_SIZE + bloblen + BLOBTAIL_SIZE + BLK_SIZE - 1) / BLK_SIZE)
+	return RPMRC_FAIL;	/* bad blob */
+    /* the trailer is at the end of the blks */
+    tail = blks + (size_t)blkcnt * BLK_SIZE - BLOBTAIL_SIZE;
+    if (verifyadler && le2h(tail) != update_adler32(ADLER32_INIT, blks, tail - blks))
+	return RPMRC_FAIL;	/* bad blob, adler32 mismatch */
+    if (le2h(tail + 4) != bloblen)
+	return RPMRC_FAIL;	/* bad blob, bloblen mismatch */
+    if (le2h(tail + 8) != BLOBTAIL_MAGIC)
+	return RPMRC_FAIL;	/* bad blob */
+    if (blobp)
+	*blobp = blks + BLOBHEAD_SIZE;
+    if (bloblp)
+	*bloblp = bloblen;
+    if (generationp)
+	*generationp = generation;
+    return RPMRC_OK;
+}
+
 static int rpmpkgVerifyblob(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned int blkoff, unsigned int blkcnt)
 {
     unsigned char buf[65536];
+    unsigned char *blks = rpmpkgMapBlks(pkgdb, blkoff, blkcnt);
+    if (blks)
+	return rpmpkgCheckMappedBlob(blks, pkgidx, blkcnt, 0, 0, 0, 1);
     return rpmpkgReadBlob(pkgdb, pkgidx, blkoff, blkcnt, buf, 0, 0);
 }
 
@@ -886,6 +960,9 @@ int rpmpkgOpen(rpmpkgdb *pkgdbp, const char *filename, int flags, int mode)
 
 void rpmpkgClose(rpmpkgdb pkgdb)
 {
+    if (pkgdb->map)
+	munmap(pkgdb->map, pkgdb->mapsize);
+    pkgdb->map = 0;
     if (pkgdb->fd >= 0) {
 	close(pkgdb->fd);
 	pkgdb->fd = -1;
@@ -1069,6 +1146,16 @@ static rpmRC rpmpkgGetInternal(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned cha
     if (!slot) {
 	return RPMRC_NOTFOUND;
     }
+    /* copy straight from the mapping, while still holding the lock */
+    if ((blob = rpmpkgMapBlks(pkgdb, slot->blkoff, slot->blkcnt)) != NULL) {
+	unsigned char *mblob;
+	unsigned int bloblen;
+	if (rpmpkgCheckMappedBlob(blob, pkgidx, slot->blkcnt, &mblob, &bloblen, (unsigned int *)0, 0))
+	    return RPMRC_FAIL;
+	*blobp = memcpy(xmalloc(bloblen ? bloblen : 1), mblob, bloblen);
+	*bloblp = bloblen;
+	return RPMRC_OK;
+    }
     blob = xmalloc((size_t)slot->blkcnt * BLK_SIZE);
     if (rpmpkgReadBlob(pkgdb, pkgidx, slot->blkoff, slot->blkcnt, blob, bloblp, (unsigned int *)0)) {
 	free(blob);
@@ -13,6 +13,7 @@
 #include "debug.h"
 
 static const int sleep_ms = 50;
+static const int mmap_size = 1 << 30;	/* max. mapping for readers */
 
 struct sqlite_cursor : public dbiCursor_s {
     sqlite3 *sdb;
@@ -175,6 +176,9 @@ static int sqlite_init(rpmdb rdb, const char * dbhome)
 		/* Sqlite default threshold is way too low for rpmdb */
 		sqlexec(sdb, "PRAGMA wal_autocheckpoint = 10000");
 	    }
+	} else {
+	    /* Let readers get the blobs straight from the page cache */
+	    sqlexec(sdb, "PRAGMA mmap_size = %d", mmap_size);
 	}
 
 	rdb->db_dbenv = sdb;
@@ -426,6 +430,12 @@ static int sqlite_Ctrl(rpmdb rdb, dbCtrlOp ctrl)
     case DB_CTRL_UNLOCK_RW:
 	rc = sqlexec((sqlite3 *)rdb->db_dbenv, "RELEASE 'rwlock'");
 	break;
+    case DB_CTRL_BATCH_BEGIN:
+	rc = sqlexec((sqlite3 *)rdb->db_dbenv, "SAVEPOINT 'batch'");
+	break;
+    case DB_CTRL_BATCH_COMMIT:
+	rc = sqlexec((sqlite3 *)rdb->db_dbenv, "RELEASE 'batch'");
+	break;
     default:
 	break;
     }
@@ -7,6 +7,7 @@
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <rpm/rpmlib.h>		/* rpmVersionCompare, rpmlib provides */
 #include <rpm/rpmtag.h>
@@ -36,7 +37,71 @@ const char * const rpmEVR = VERSION;
 
 const int rpmFLAGS = RPMSENSE_EQUAL;
 
-using depCache = std::unordered_map<std::string,int>;
+/* A dependency, in terms of the transaction set string pool */
+struct depKey {
+    rpmTagVal tag;
+    rpmsid N;
+    rpmsid EVR;
+    rpmsenseFlags sense;
+    unsigned int instance;	/*!< Self-conflicts and -obsoletes need this */
+
+    bool operator==(const depKey & other) const {
+	return tag == other.tag && N == other.N && EVR == other.EVR &&
+	       sense == other.sense && instance == other.instance;
+    }
+};
+
+struct depKeyHash {
+    size_t operator()(const depKey & k) const {
+	size_t h = std::hash<rpmsid>{}(k.N);
+	h = h * 31 + std::hash<rpmsid>{}(k.EVR);
+	h = h * 31 + (k.tag ^ (k.sense << 8) ^ (size_t(k.instance) << 16));
+	return h;
+    }
+};
+
+/*
+ * The rpmdb lookups of the dependency check, kept in the transaction set
+ * for the next check. The results are valid as long as the rpmdb contents
+ * and the transaction color stay the same. Adding erasures to the
+ * transaction only affects the dependencies satisfied by those packages.
+ */
+struct depCache {
+    char *cookie {};		/*!< rpmdb cookie of the results */
+    rpm_color_t color {};	/*!< Transaction color of the results */
+    std::unordered_map<depKey,int,depKeyHash> deps;	/*!< dep -> result */
+    /*! hdrNum -> satisfied dependencies */
+    std::unordered_map<unsigned int,std::vector<depKey>> satisfied;
+    std::unordered_map<unsigned int,rpmds> provides;	/*!< hdrNum -> provides */
+
+    void insert(const depKey & key, int rc, unsigned int hdrNum) {
+	deps.insert({key, rc});
+	if (rc == 0)
+	    satisfied[hdrNum].push_back(key);
+    }
+
+    void pruned(unsigned int hdrNum) {
+	auto it = satisfied.find(hdrNum);
+	if (it != satisfied.end()) {
+	    for (auto const & key : it->second)
+		deps.erase(key);
+	    satisfied.erase(it);
+	}
+    }
+
+    void clear() {
+	for (auto & p : provides)
+	    rpmdsFree(p.second);
+	provides.clear();
+	satisfied.clear();
+	deps.clear();
+	cookie = _free(cookie);
+    }
+
+    ~depCache() {
+	clear();
+    }
+};
 using depexistsHash = std::unordered_set<rpmsid>;
 using filedepHash = std::unordered_map<rpmsid,rpmsid>;
 
@@ -111,12 +176,24 @@ static int removePackage(rpmts ts, Header h, rpmte depends)
     tsmem->removedPackages.insert({dboffset, p});
     rpmteSetDependsOn(p, depends);
 
+    /* Cached lookups can no longer be satisfied by this package */
+    if (ts->depcache)
+	ts->depcache->pruned(dboffset);
+
     addElement(tsmem, p, -1);
     rpmtsNotifyChange(ts, RPMTS_EVENT_ADD, p, depends);
 
     return 0;
 }
 
+void rpmtsFreeDepCache(rpmts ts)
+{
+    if (ts) {
+	delete ts->depcache;
+	ts->depcache = NULL;
+    }
+}
+
 /* Return rpmdb iterator with removals optionally pruned out */
 rpmdbMatchIterator rpmtsPrunedIterator(rpmts ts, rpmDbiTagVal tag,
 					      const char * key, int prune)
@@ -492,22 +569,109 @@ int rpmtsAddEraseElement(rpmts ts, Header h, int dboffset)
     return removePackage(ts, h, NULL);
 }
 
+/*
+ * Match a dependency against the Providename index entries in an iterator.
+ * The index entry already tells which package and which provide of it
+ * has the wanted name, so unversioned dependencies are resolved from the
+ * index alone. Versioned dependencies need the provide EVR and flags,
+ * these are loaded from the header once per package and kept in the
+ * cache.
+ * Returns 1 if satisfied, 0 otherwise. The satisfying package is
+ * returned in hdrNump.
+ */
+static int rpmdbProvidesIndex(rpmts ts, depCache *dcache,
+			      rpmdbMatchIterator mi, rpmds dep,
+			      dbiIndexSet *matches, unsigned int *hdrNump)
+{
+    rpmstrPool tspool = rpmtsPool(ts);
+    rpmTagVal deptag = rpmdsTagN(dep);
+    const char *EVR = rpmdsEVR(dep);
+    int versioned = (rpmdsFlags(dep) & RPMSENSE_SENSEMASK) && EVR && *EVR;
+    int count = rpmdbGetIteratorCount(mi);
+    int found = 0;
+
+    for (int i = 0; i < count; i++) {
+	unsigned int hdrNum = rpmdbGetIteratorOffsetFor(mi, i);
+	int prix = rpmdbGetIteratorFileNumFor(mi, i);
+	int match = 1;
+
+	if (hdrNum == 0)
+	    continue;
+
+	if (versioned) {
+	    rpmds provides = NULL;
+	    auto it = dcache->provides.find(hdrNum);
+	    if (it != dcache->provides.end()) {
+		provides = it->second;
+	    } else {
+		Header h = rpmdbGetHeaderAt(rpmtsGetRdb(ts), hdrNum);
+		if (h == NULL)
+		    continue;
+		provides = rpmdsNewPool(tspool, h, RPMTAG_PROVIDENAME, 0);
+		dcache->provides.insert({hdrNum, provides});
+		headerFree(h);
+	    }
+	    match = (rpmdsSetIx(provides, prix) >= 0) ?
+			rpmdsCompare(provides, dep) : 0;
+	}
+
+	/* Ignore self-conflicts */
+	if (match && deptag == RPMTAG_CONFLICTNAME) {
+	    if (hdrNum == rpmdsInstance(dep))
+		match = 0;
+	}
+	if (match) {
+	    found = 1;
+	    if (matches) {
+		dbiIndexSetAppendOne(*matches, hdrNum, 0, 0);
+		continue;
+	    }
+	    *hdrNump = hdrNum;
+	    break;
+	}
+    }
+    return found;
+}
+
+/* Cache key of a dependency, returns 0 if it can't be cached */
+static int depCacheKey(rpmts ts, rpmds dep, depKey *key)
+{
+    rpmTagVal tag = rpmdsTagN(dep);
+    rpmsenseFlags sense = rpmdsFlags(dep) & RPMSENSE_SENSEMASK;
+
+    /* Pool ids are only comparable within the same pool */
+    if (rpmdsPool(dep) != rpmtsPool(ts))
+	return 0;
+
+    key->tag = tag;
+    key->N = rpmdsNId(dep);
+    key->EVR = sense ? rpmdsEVRId(dep) : 0;
+    key->sense = sense;
+    key->instance = (tag == RPMTAG_CONFLICTNAME ||
+		     tag == RPMTAG_OBSOLETENAME) ? rpmdsInstance(dep) : 0;
+    return 1;
+}
+
 /* Cached rpmdb provide lookup, returns 0 if satisfied, 1 otherwise */
 static int rpmdbProvides(rpmts ts, depCache *dcache, rpmds dep, dbiIndexSet *matches)
 {
     const char * Name = rpmdsN(dep);
-    const char * DNEVR = rpmdsDNEVR(dep);
     rpmTagVal deptag = rpmdsTagN(dep);
     rpmdbMatchIterator mi = NULL;
     Header h = NULL;
+    unsigned int hdrNum = 0;
+    int found = 0;
     int rc = 0;
     /* pretrans deps are provided by current packages, don't prune erasures */
     int prune = (rpmdsFlags(dep) & (RPMSENSE_PRETRANS|RPMSENSE_PREUNTRANS)) ? 0 : 1;
+    /* Caching the oddball non-pruned case would mess up other results */
+    depKey key;
+    int cache = prune && !matches && depCacheKey(ts, dep, &key);
 
     /* See if we already looked this up */
-    if (prune && !matches) {
-	auto ret = dcache->find(DNEVR);
-	if (ret != dcache->end()) {
+    if (cache) {
+	auto ret = dcache->deps.find(key);
+	if (ret != dcache->deps.end()) {
 	    rc = ret->second;
 	    rpmdsNotify(dep, "(cached)", rc);
 	    return rc;
@@ -535,13 +699,15 @@ static int rpmdbProvides(rpmts ts, depCache *dcache, rpmds dep, dbiIndexSet *mat
 		continue;
 	    }
 	    rpmdsNotify(dep, "(db files)", rc);
+	    hdrNum = headerGetInstance(h);
 	    break;
 	}
 	rpmdbFreeIterator(mi);
+	found = (h != NULL);
     }
 
     /* Otherwise look in provides no matter what the dependency looks like */
-    if (h == NULL) {
+    if (!found) {
 	rpmstrPool tspool = rpmtsPool(ts);
 	/* Obsoletes use just name alone, everything else uses provides */
 	rpmTagVal dbtag = RPMDBI_PROVIDENAME;
@@ -552,28 +718,35 @@ static int rpmdbProvides(rpmts ts, depCache *dcache, rpmds dep, dbiIndexSet *mat
 	}
 
 	mi = rpmtsPrunedIterator(ts, dbtag, Name, prune);
-	while ((h = rpmdbNextIterator(mi)) != NULL) {
-	    /* Provide-indexes can't be used with nevr-only matching */
-	    int prix = (selfevr) ? -1 : rpmdbGetIteratorFileNum(mi);
-	    int match = rpmdsMatches(tspool, h, prix, dep, selfevr);
-	    /* Ignore self-obsoletes and self-conflicts */
-	    if (match && (deptag == RPMTAG_OBSOLETENAME || deptag == RPMTAG_CONFLICTNAME)) {
-		unsigned int instance = headerGetInstance(h);
-		if (instance && instance == rpmdsInstance(dep))
-		    match = 0;
-	    }
-	    if (match) {
-		if (matches) {
-		    dbiIndexSetAppendOne(*matches, headerGetInstance(h), 0, 0);
-		    continue;
+	if (selfevr) {
+	    while ((h = rpmdbNextIterator(mi)) != NULL) {
+		/* Provide-indexes can't be used with nevr-only matching */
+		int match = rpmdsMatches(tspool, h, -1, dep, selfevr);
+		/* Ignore self-obsoletes */
+		if (match) {
+		    unsigned int instance = headerGetInstance(h);
+		    if (instance && instance == rpmdsInstance(dep))
+			match = 0;
+		}
+		if (match) {
+		    if (matches) {
+			dbiIndexSetAppendOne(*matches, headerGetInstance(h), 0, 0);
+			continue;
+		    }
+		    rpmdsNotify(dep, "(db provides)", rc);
+		    hdrNum = headerGetInstance(h);
+		    break;
 		}
-		rpmdsNotify(dep, "(db provides)", rc);
-		break;
 	    }
+	    found = (h != NULL);
+	} else {
+	    found = rpmdbProvidesIndex(ts, dcache, mi, dep, matches, &hdrNum);
+	    if (found && !matches)
+		rpmdsNotify(dep, "(db provides)", rc);
 	}
 	rpmdbFreeIterator(mi);
     }
-    rc = (h != NULL) ? 0 : 1;
+    rc = found ? 0 : 1;
 
     if (matches) {
 	dbiIndexSetUniq(*matches, 0);
@@ -581,9 +754,8 @@ static int rpmdbProvides(rpmts ts, depCache *dcache, rpmds dep, dbiIndexSet *mat
     }
 
     /* Cache the relatively expensive rpmdb lookup results */
-    /* Caching the oddball non-pruned case would mess up other results */
-    if (prune && !matches)
-	dcache->insert({DNEVR, rc});
+    if (cache)
+	dcache->insert(key, rc, hdrNum);
     return rc;
 }
 
@@ -633,7 +805,10 @@ exit_rich:
     }
 
     /* match database entries */
-    rpmdbProvides(ts, NULL, dep, &set1);
+    {
+	depCache dcache;
+	rpmdbProvides(ts, &dcache, dep, &set1);
+    }
 
     /* Pretrans dependencies can't be satisfied by added packages. */
     if (!(dsflags & (RPMSENSE_PRETRANS|RPMSENSE_PREUNTRANS))) {
@@ -1000,13 +1175,33 @@ static filedepHash *filedepHashFree(filedepHash *hash)
     return NULL;
 }
 
+/* Return the dependency cache of ts, emptied if no longer valid */
+static depCache *depCacheGet(rpmts ts, rpmdb rdb, rpm_color_t color)
+{
+    char *cookie = rdb ? rpmdbCookie(rdb) : NULL;
+
+    if (ts->depcache == NULL)
+	ts->depcache = new depCache {};
+
+    depCache *dcache = ts->depcache;
+    if (cookie == NULL || dcache->cookie == NULL ||
+	    !rstreq(cookie, dcache->cookie) || color != dcache->color) {
+	dcache->clear();
+	dcache->cookie = cookie;
+	dcache->color = color;
+    } else {
+	free(cookie);
+    }
+    return dcache;
+}
+
 int rpmtsCheck(rpmts ts)
 {
     rpm_color_t tscolor = rpmtsColor(ts);
     rpmtsi pi = NULL; rpmte p;
     int closeatexit = 0;
     int rc = 0;
-    depCache _dcache, *dcache = &_dcache;
+    depCache *dcache = NULL;
     filedepHash *confilehash = NULL;	/* file conflicts of installed packages */
     filedepHash *connotfilehash = NULL;	/* file conflicts of installed packages */
     depexistsHash *connothash = NULL;
@@ -1030,6 +1225,9 @@ int rpmtsCheck(rpmts ts)
     if (rdb)
 	rpmdbCtrl(rdb, RPMDB_CTRL_LOCK_RO);
 
+    /* Reuse the rpmdb lookups of previous checks where possible */
+    dcache = depCacheGet(ts, rdb, tscolor);
+
     /* build hashes of all confilict sdependencies */
     confilehash = new filedepHash {};
     connothash = new depexistsHash {};
@@ -5,7 +5,10 @@
 #include "system.h"
 
 #include <map>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
+#include <vector>
 
 #include <rpm/rpmfileutil.h>	/* for rpmCleanPath */
 #include <rpm/rpmstring.h>
@@ -73,12 +76,27 @@ struct fpLess
 
 using rpmFpEntryHash = std::unordered_multimap<rpmsid,fprintCacheEntry_s>;
 using rpmFpHash = std::multimap<fingerPrint *,rpmffi_s,fpLess>;
+using wrlock = std::unique_lock<std::shared_mutex>;
+using rdlock = std::shared_lock<std::shared_mutex>;
+
+/* Number of independently locked directory cache shards */
+#define FP_SHARDS 64
+
+/**
+ * Directory cache shard, directories are sharded by their string id.
+ */
+struct fprintCacheShard_s {
+    std::shared_mutex mutex;
+    rpmFpEntryHash ht;			/*!< hashed by dirName */
+};
 
 /**
  * Finger print cache.
+ * The directory cache is safe for concurrent lookups, the fingerprint
+ * hash is not.
  */
 struct fprintCache_s {
-    rpmFpEntryHash ht;			/*!< hashed by dirName */
+    fprintCacheShard_s dirs[FP_SHARDS];	/*!< directory cache shards */
     rpmFpHash fp;			/*!< hashed by fingerprint */
     rpmstrPool pool;			/*!< string pool */
 };
@@ -108,12 +126,32 @@ fingerPrintCache fpCacheFree(fingerPrintCache cache)
 static const struct fprintCacheEntry_s * cacheContainsDirectory(
 			    fingerPrintCache cache, rpmsid dirId)
 {
-    auto entry = cache->ht.find(dirId);
-    if (entry != cache->ht.end())
+    fprintCacheShard_s & shard = cache->dirs[dirId % FP_SHARDS];
+    rdlock lock(shard.mutex);
+    auto entry = shard.ht.find(dirId);
+    if (entry != shard.ht.end())
 	return &entry->second;
     return NULL;
 }
 
+/**
+ * Add directory name entry to cache, unless another thread beat us to it.
+ * @param cache		pointer to fingerprint cache
+ * @param newEntry	directory entry to add
+ * @return pointer to directory name entry in cache
+ */
+static const struct fprintCacheEntry_s * cacheAddDirectory(
+			    fingerPrintCache cache,
+			    const struct fprintCacheEntry_s & newEntry)
+{
+    fprintCacheShard_s & shard = cache->dirs[newEntry.dirId % FP_SHARDS];
+    wrlock lock(shard.mutex);
+    auto entry = shard.ht.find(newEntry.dirId);
+    if (entry == shard.ht.end())
+	entry = shard.ht.insert({newEntry.dirId, newEntry});
+    return &entry->second;
+}
+
 static char * canonDir(rpmstrPool pool, rpmsid dirNameId)
 {
     const char * dirName = rpmstrPoolStr(pool, dirNameId);
@@ -172,8 +210,7 @@ static int doLookupId(fingerPrintCache cache,
 		.dev = sb.st_dev,
 		.ino = sb.st_ino,
 	    };
-	    auto ret = cache->ht.insert({fpId, newEntry});
-	    fp->entry = &ret->second;
+	    fp->entry = cacheAddDirectory(cache, newEntry);
 	}
 
         if (fp->entry) {
@@ -403,61 +440,65 @@ void fpCachePopulate(fingerPrintCache fpc, rpmts ts, int fileCount)
     rpmfiles fi;
     int i, fc;
     int havesymlinks = 0;
+    std::vector<std::pair<rpmte,rpmfiles>> elems;
 
     rpmFpHash symlinks;
 
-    /* populate the fingerprints of all packages in the transaction */
-    /* also create a hash of all symlinks in the new packages */
     pi = rpmtsiInit(ts);
     while ((p = rpmtsiNext(pi, 0)) != NULL) {
-	if ((fi = rpmteFiles(p)) == NULL)
+	if ((fi = rpmteFiles(p)) != NULL)
+	    elems.push_back({p, fi});
+    }
+    rpmtsiFree(pi);
+
+    /*
+     * Look up the fingerprints of all packages in the transaction. This is
+     * mostly stat(2) calls on directories and independent for each
+     * package, so it's done in parallel, sharing the directory cache.
+     */
+    (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t e = 0; e < elems.size(); e++)
+	rpmfilesFpLookup(elems[e].second, fpc);
+
+    /* create a hash of all symlinks in the new packages */
+    for (auto const & [p, fi] : elems) {
+	if (rpmteType(p) == TR_REMOVED)
 	    continue;
 
-	(void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
-	rpmfilesFpLookup(fi, fpc);
+	fingerPrint *fpList = rpmfilesFps(fi);
 	fs = rpmteGetFileStates(p);
 	fc = rpmfsFC(fs);
-
-	if (rpmteType(p) != TR_REMOVED) {
-	    fingerPrint *fpList = rpmfilesFps(fi);
-	    /* collect symbolic links */
-	    for (i = 0; i < fc; i++) {
-		struct rpmffi_s ffi;
-		char const *linktarget;
-		if (XFA_SKIPPING(rpmfsGetAction(fs, i)))
-		    continue;
-		linktarget = rpmfilesFLink(fi, i);
-		if (!(linktarget && *linktarget != '\0'))
-		    continue;
-		ffi.p = p;
-		ffi.fileno = i;
-		fingerPrint *fp = fpList + i;
-		if (fp->entry)
-		    symlinks.insert({fp, ffi});
-		havesymlinks = 1;
-	    }
+	/* collect symbolic links */
+	for (i = 0; i < fc; i++) {
+	    struct rpmffi_s ffi;
+	    char const *linktarget;
+	    if (XFA_SKIPPING(rpmfsGetAction(fs, i)))
+		continue;
+	    linktarget = rpmfilesFLink(fi, i);
+	    if (!(linktarget && *linktarget != '\0'))
+		continue;
+	    ffi.p = p;
+	    ffi.fileno = i;
+	    fingerPrint *fp = fpList + i;
+	    if (fp->entry)
+		symlinks.insert({fp, ffi});
+	    havesymlinks = 1;
 	}
-
-	(void) rpmswExit(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), fc);
-	rpmfilesFree(fi);
     }
-    rpmtsiFree(pi);
 
     /* ===============================================
      * Create the fingerprint -> (p, fileno) hash table
      * Also adapt the fingerprint if we have symlinks
+     * This modifies fingerprints used as symlink hash keys as it goes,
+     * so it's done serially in transaction order.
      */
-    pi = rpmtsiInit(ts);
-    while ((p = rpmtsiNext(pi, 0)) != NULL) {
-	fingerPrint *fpList, *lastfp = NULL;
-
-	if ((fi = rpmteFiles(p)) == NULL)
-	    continue;
+    for (auto const & [p, fi] : elems) {
+	fingerPrint *fpList = rpmfilesFps(fi);
+	fingerPrint *lastfp = NULL;
 
 	fs = rpmteGetFileStates(p);
 	fc = rpmfsFC(fs);
-	fpList = rpmfilesFps(fi);
-	(void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
 	for (i = 0; i < fc; i++) {
 	    struct rpmffi_s ffi;
 	    if (XFA_SKIPPING(rpmfsGetAction(fs, i)))
@@ -475,9 +516,7 @@ void fpCachePopulate(fingerPrintCache fpc, rpmts ts, int fileCount)
 	    if (lastfp->entry)
 		fpc->fp.insert({lastfp, ffi});
 	}
-	(void) rpmswExit(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
 	rpmfilesFree(fi);
     }
-    rpmtsiFree(pi);
+    (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), fileCount);
 }
-
@@ -9,9 +9,21 @@
 #include <utime.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #ifdef WITH_CAP
 #include <sys/capability.h>
 #endif
+#ifdef WITH_LIBURING
+#include <liburing.h>
+#endif
+#ifdef ENABLE_OPENMP
+#include <omp.h>
+#endif
 
 #include <rpm/rpmte.h>
 #include <rpm/rpmts.h>
@@ -33,6 +45,13 @@ int _fsm_debug = _FSM_DEBUG;
 /* XXX Failure to remove is not (yet) cause for failure. */
 static int strict_erasures = 0;
 
+/* Values of %_flush_io */
+enum fsmflush_e {
+    FLUSH_NONE		= 0,	/* leave it all to the kernel */
+    FLUSH_FILE		= 1,	/* fsync() every file on close */
+    FLUSH_PACKAGE	= 2,	/* sync filesystems once per package */
+};
+
 #define	SUFFIX_RPMORIG	".rpmorig"
 #define	SUFFIX_RPMSAVE	".rpmsave"
 #define	SUFFIX_RPMNEW	".rpmnew"
@@ -41,6 +60,13 @@ static int strict_erasures = 0;
 #define _dirPerms 0755
 #define _filePerms 0644
 
+/* Larger files are always written directly from the payload */
+#define _jobMaxFileSize (1024 * 1024)
+/* Upper limit of file content buffered for writer threads */
+#define _jobMaxBufSize (64 * 1024 * 1024)
+/* Number of io_uring entries, also the maximum number of jobs in flight */
+#define _jobRingSize 256
+
 enum filestage_e {
     FILE_COMMIT = -1,
     FILE_NONE   = 0,
@@ -60,13 +86,42 @@ struct filedata_s {
     struct stat sb;
 };
 
+/* Regular file content to be written out by a worker thread */
+struct filejob_s {
+    struct filedata_s *fp;	/* file data of the written file */
+    int fx;			/* payload file index */
+    int fd;			/* file descriptor to write to */
+    int rc;			/* result code */
+    int err;			/* errno on failure */
+    size_t off;			/* amount of content written (io_uring) */
+    std::vector<char> buf;	/* file content */
+    std::atomic_bool done;	/* write (and verify) completed */
+};
+
+struct fsmjobs_s {
+    int nthreads;		/* number of writer threads */
+    size_t maxjobs;		/* maximum number of jobs in flight */
+    size_t bufsize;		/* amount of content buffered in jobs */
+    rpmfi fi;			/* iterator for setting metadata on jobs */
+    struct io_uring *ring;	/* io_uring for writing, NULL for threads */
+    rpmop syncop;		/* where to account flushes */
+    size_t inflight;		/* number of writes queued on the ring */
+    std::deque<struct filejob_s *> queue;
+    std::mutex mutex;		/* for waiting on writer threads */
+    std::condition_variable cond;
+};
+
 /* 
  * XXX Forward declarations for previously exported functions to avoid moving 
  * things around needlessly 
  */ 
 static const char * fileActionString(rpmFileAction a);
 static int fsmOpenat(int *fdp, int dirfd, const char *path, int flags, int dir);
-static int fsmClose(int *wfdp);
+static int fsmClose(int *wfdp, rpmop syncop);
+static int fsmSetmeta(int fd, int dirfd, const char *path,
+		      rpmfi fi, rpmPlugins plugins,
+		      rpmFileAction action, const struct stat * st,
+		      int nofcaps);
 
 /** \ingroup payload
  * Build path to file from file info, optionally ornamented with suffix.
@@ -102,7 +157,7 @@ static int cap_set_fileat(int dirfd, const char *path, cap_t fcaps)
     int rc = fsmOpenat(&fd, dirfd, path, O_RDONLY|O_NOFOLLOW, 0);
     if (!rc) {
 	rc = cap_set_fd(fd, fcaps);
-	fsmClose(&fd);
+	close(fd);
     }
     return rc;
 }
@@ -134,21 +189,46 @@ static int fsmSetFCaps(int fd, int dirfd, const char *path, const char *captxt)
     return rc;
 }
 
-static int fsmClose(int *wfdp)
+static int fsmFlushMode(void)
+{
+    static int oneshot = 0;
+    static int flush_io = FLUSH_NONE;
+
+    if (!oneshot) {
+	flush_io = rpmExpandNumeric("%{?_flush_io}");
+	/* Unknown positive values keep their old "fsync everything" meaning */
+	if (flush_io > FLUSH_PACKAGE)
+	    flush_io = FLUSH_FILE;
+	else if (flush_io < FLUSH_NONE)
+	    flush_io = FLUSH_NONE;
+	oneshot = 1;
+    }
+    return flush_io;
+}
+
+/*
+ * Close a file descriptor, flushing it as configured. Flushes are
+ * accounted in syncop (if not NULL).
+ */
+static int fsmClose(int *wfdp, rpmop syncop)
 {
     int rc = 0;
     if (wfdp && *wfdp >= 0) {
 	int myerrno = errno;
-	static int oneshot = 0;
-	static int flush_io = 0;
 	int fdno = *wfdp;
 
-	if (!oneshot) {
-	    flush_io = (rpmExpandNumeric("%{?_flush_io}") > 0);
-	    oneshot = 1;
-	}
-	if (flush_io) {
+	switch (fsmFlushMode()) {
+	case FLUSH_FILE:
+	    (void) rpmswEnter(syncop, 0);
 	    fsync(fdno);
+	    (void) rpmswExit(syncop, 0);
+	    break;
+	case FLUSH_PACKAGE:
+#ifdef SYNC_FILE_RANGE_WRITE
+	    /* Start writeback now, the filesystem gets synced later */
+	    sync_file_range(fdno, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+	    break;
 	}
 	if (close(fdno))
 	    rc = RPMERR_CLOSE_FAILED;
@@ -194,10 +274,365 @@ static int fsmUnpack(rpmfi fi, int fdno, rpmpsm psm, int nodigest)
     return rc;
 }
 
+/* Verify the digest of buffered file content */
+static int fsmJobVerify(struct filejob_s *job, rpmfiles files, int nodigest)
+{
+    int rc = 0;
+
+    if (!nodigest) {
+	DIGEST_CTX ctx = rpmDigestInit(rpmfilesDigestAlgo(files), RPMDIGEST_NONE);
+	void *digest = NULL;
+	rpmDigestUpdate(ctx, job->buf.data(), job->buf.size());
+	rpmDigestFinal(ctx, &digest, NULL, 0);
+	rc = rpmfilesVerifyDigest(files, job->fx, digest);
+	free(digest);
+    }
+    return rc;
+}
+
+/* Write out buffered file content and verify its digest, in a worker */
+static void fsmJobWrite(struct filejob_s *job, rpmfiles files, int nodigest)
+{
+    const char *p = job->buf.data() + job->off;
+    size_t left = job->buf.size() - job->off;
+    off_t off = job->off;
+    int rc = job->rc;
+
+    if (!rc)
+	rc = fsmJobVerify(job, files, nodigest);
+
+    /* Positional as the ring may have written out a part already */
+    while (!rc && left > 0) {
+	ssize_t nb = pwrite(job->fd, p, left, off);
+	if (nb < 0) {
+	    if (errno == EINTR)
+		continue;
+	    rc = RPMERR_WRITE_FAILED;
+	    job->err = errno;
+	    break;
+	}
+	p += nb;
+	left -= nb;
+	off += nb;
+    }
+
+    if (_fsm_debug) {
+	rpmlog(RPMLOG_DEBUG, " %8s (%d %zu bytes [%d]) %s\n", __func__,
+	       job->fx, job->buf.size(), job->fd,
+	       (rc < 0 ? strerror(job->err) : ""));
+    }
+
+    job->rc = rc;
+    job->done = true;
+}
+
+#ifdef WITH_LIBURING
+/* Queue a write of the remaining job content on the ring */
+static int fsmRingPrep(struct fsmjobs_s *jobs, struct filejob_s *job)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(jobs->ring);
+
+    /* Submission queue full, make room */
+    if (sqe == NULL) {
+	io_uring_submit(jobs->ring);
+	sqe = io_uring_get_sqe(jobs->ring);
+    }
+    if (sqe == NULL)
+	return 1;
+
+    io_uring_prep_write(sqe, job->fd, job->buf.data() + job->off,
+			job->buf.size() - job->off, job->off);
+    io_uring_sqe_set_data(sqe, job);
+    jobs->inflight++;
+    return 0;
+}
+
+static void fsmRingFree(struct io_uring *ring);
+
+/* Process a completed write, short writes get resubmitted */
+static void fsmRingDone(struct fsmjobs_s *jobs, rpmfiles files,
+			struct io_uring_cqe *cqe)
+{
+    struct filejob_s *job = (struct filejob_s *)io_uring_cqe_get_data(cqe);
+    int res = cqe->res;
+
+    io_uring_cqe_seen(jobs->ring, cqe);
+    jobs->inflight--;
+
+    if (res == -EINTR || res == -EAGAIN) {
+	res = 0;
+    } else if (res < 0 || (res == 0 && job->off < job->buf.size())) {
+	job->rc = RPMERR_WRITE_FAILED;
+	job->err = res ? -res : ENOSPC;
+	job->done = true;
+	return;
+    }
+
+    job->off += res;
+    if (job->off >= job->buf.size()) {
+	job->done = true;
+    } else if (fsmRingPrep(jobs, job)) {
+	/* No room on the ring, write out the rest directly */
+	fsmJobWrite(job, files, 1);
+    }
+}
+
+/*
+ * Submitting to the ring failed for good, so the queued writes would never
+ * complete. Wait for the writes the kernel already has, write out the rest
+ * directly and stop using the ring. The entries not submitted never reach
+ * the kernel as the ring isn't entered for submission again.
+ */
+static void fsmRingFail(struct fsmjobs_s *jobs, rpmfiles files, int err)
+{
+    struct io_uring_cqe *cqe = NULL;
+
+    rpmlog(RPMLOG_WARNING, _("io_uring submit failed, writing files directly: %s\n"),
+	   strerror(-err));
+
+    while (jobs->inflight > io_uring_sq_ready(jobs->ring)) {
+	int xx = io_uring_wait_cqe(jobs->ring, &cqe);
+	if (xx == -EINTR || xx == -EAGAIN)
+	    continue;
+	if (xx < 0) {
+	    rpmlog(RPMLOG_ERR, _("io_uring wait failed: %s\n"), strerror(-xx));
+	    break;
+	}
+	fsmRingDone(jobs, files, cqe);
+    }
+
+    for (auto job : jobs->queue) {
+	if (!job->done)
+	    fsmJobWrite(job, files, 1);
+    }
+
+    fsmRingFree(jobs->ring);
+    jobs->ring = NULL;
+    jobs->inflight = 0;
+}
+
+/*
+ * Submit queued writes and process the completed ones, waiting for at
+ * least one completion if asked to.
+ */
+static void fsmRingReap(struct fsmjobs_s *jobs, rpmfiles files, int wait)
+{
+    struct io_uring_cqe *cqe = NULL;
+    int xx;
+
+    if (wait)
+	xx = io_uring_submit_and_wait(jobs->ring, 1);
+    else
+	xx = io_uring_submit(jobs->ring);
+    if (xx < 0 && xx != -EINTR && xx != -EAGAIN && xx != -EBUSY) {
+	fsmRingFail(jobs, files, xx);
+	return;
+    }
+
+    while (io_uring_peek_cqe(jobs->ring, &cqe) == 0)
+	fsmRingDone(jobs, files, cqe);
+
+    if (_fsm_debug) {
+	rpmlog(RPMLOG_DEBUG, " %8s (%d) %s\n", __func__,
+	       wait, (xx < 0 ? strerror(-xx) : ""));
+    }
+}
+#endif
+
+/* Verify file content and queue it for writing on the ring */
+static void fsmRingWrite(struct fsmjobs_s *jobs, struct filejob_s *job,
+			 rpmfiles files, int nodigest)
+{
+#ifdef WITH_LIBURING
+    job->rc = fsmJobVerify(job, files, nodigest);
+    if (job->rc || job->buf.empty())
+	job->done = true;
+    else if (fsmRingPrep(jobs, job))
+	fsmJobWrite(job, files, 1);
+#endif
+}
+
+/* Set up an io_uring for writing out files, if enabled and available */
+static struct io_uring *fsmRingInit(void)
+{
+    struct io_uring *ring = NULL;
+#ifdef WITH_LIBURING
+    static std::atomic_bool unsupported(false);
+
+    if (unsupported || rpmExpandNumeric("%{?_install_io_uring}") <= 0)
+	return NULL;
+
+    ring = new io_uring {};
+    int xx = io_uring_queue_init(_jobRingSize, ring, 0);
+    if (xx < 0) {
+	/* Not supported by the kernel or disallowed, don't try again */
+	rpmlog(RPMLOG_DEBUG, "io_uring not available: %s\n", strerror(-xx));
+	unsupported = true;
+	delete ring;
+	ring = NULL;
+    }
+#endif
+    return ring;
+}
+
+static void fsmRingFree(struct io_uring *ring)
+{
+#ifdef WITH_LIBURING
+    if (ring) {
+	io_uring_queue_exit(ring);
+	delete ring;
+    }
+#endif
+}
+
+/* Read file content from the payload and hand it over to a writer thread */
+static int fsmJobQueue(struct fsmjobs_s *jobs, rpmfi fi, struct filedata_s *fp,
+			int fd, rpmfiles files, rpmpsm psm, int nodigest)
+{
+    struct filejob_s *job = new filejob_s {};
+    rpm_loff_t left = rpmfiFSize(fi);
+    char *p = NULL;
+    int rc = 0;
+
+    job->fp = fp;
+    job->fx = rpmfiFX(fi);
+    job->fd = fd;
+    job->buf.resize(left);
+    p = job->buf.data();
+
+    while (left) {
+	size_t len = (left > BUFSIZ*4) ? BUFSIZ*4 : left;
+	if (rpmfiArchiveRead(fi, p, len) != (ssize_t)len) {
+	    rc = RPMERR_READ_FAILED;
+	    break;
+	}
+	rpmpsmNotify(psm, RPMCALLBACK_INST_PROGRESS, rpmfiArchiveTell(fi));
+	p += len;
+	left -= len;
+    }
+
+    if (rc) {
+	delete job;
+    } else {
+	jobs->bufsize += job->buf.size();
+	jobs->queue.push_back(job);
+
+	if (jobs->ring) {
+	    fsmRingWrite(jobs, job, files, nodigest);
+	} else {
+	    #pragma omp task firstprivate(jobs, job, files, nodigest) if (jobs->nthreads > 1)
+	    {
+	    fsmJobWrite(job, files, nodigest);
+	    /* Wake up the reaper, see fsmJobsReap() */
+	    std::lock_guard<std::mutex> lock(jobs->mutex);
+	    jobs->cond.notify_one();
+	    } /* omp task */
+	}
+    }
+
+    return rc;
+}
+
+static int fsmJobsFull(struct fsmjobs_s *jobs)
+{
+    return (jobs->queue.size() >= jobs->maxjobs ||
+	    jobs->bufsize >= _jobMaxBufSize);
+}
+
+/*
+ * Set metadata on, and close, written out files in payload order. With
+ * wait set, all jobs are finished, otherwise only as many as needed to
+ * get below the in-flight limits.
+ */
+static int fsmJobsReap(struct fsmjobs_s *jobs, rpmfiles files,
+			rpmPlugins plugins, int nofcaps, int wait,
+			char **failedFile)
+{
+    int rc = 0;
+
+#ifdef WITH_LIBURING
+    if (jobs->ring)
+	fsmRingReap(jobs, files, 0);
+#endif
+
+    while (!jobs->queue.empty()) {
+	struct filejob_s *job = jobs->queue.front();
+	struct filedata_s *fp = job->fp;
+	int jrc;
+
+	if (!job->done) {
+	    if (!(wait || fsmJobsFull(jobs)))
+		break;
+#ifdef WITH_LIBURING
+	    if (jobs->ring) {
+		fsmRingReap(jobs, files, 1);
+		continue;
+	    }
+#endif
+	    /* Sleep until the writer of the oldest job is done */
+	    std::unique_lock<std::mutex> lock(jobs->mutex);
+	    jobs->cond.wait(lock, [job] { return job->done.load(); });
+	    continue;
+	}
+
+	rpmfiSetFX(jobs->fi, job->fx);
+	jrc = job->rc;
+	if (jrc)
+	    errno = job->err;
+
+	if (!jrc && fp->setmeta) {
+	    jrc = fsmSetmeta(job->fd, -1, fp->fpath, jobs->fi, plugins,
+			    fp->action, &fp->sb, nofcaps);
+	}
+	fsmClose(&job->fd, jobs->syncop);
+
+	if (jrc && !rc) {
+	    rc = jrc;
+	    if (*failedFile == NULL)
+		*failedFile = rstrscat(NULL, rpmfiDN(jobs->fi), fp->fpath, NULL);
+	}
+
+	jobs->queue.pop_front();
+	jobs->bufsize -= job->buf.size();
+	delete job;
+    }
+
+    return rc;
+}
+
+static int fsmJobsInit(struct fsmjobs_s *jobs, rpmfiles files, rpmop syncop)
+{
+    int nthreads = rpmExpandNumeric("%{?_install_nthreads}");
+
+    if (nthreads < 0)
+	nthreads = rpmExpandNumeric("%{getncpus:thread}");
+#ifndef ENABLE_OPENMP
+    nthreads = 1;
+#endif
+    if (nthreads < 1)
+	nthreads = 1;
+
+    jobs->ring = fsmRingInit();
+    /* With io_uring, the kernel does the writing for us */
+    if (jobs->ring)
+	nthreads = 1;
+
+    jobs->nthreads = nthreads;
+    jobs->inflight = 0;
+    jobs->syncop = syncop;
+    jobs->maxjobs = jobs->ring ? _jobRingSize : nthreads * 16;
+    jobs->bufsize = 0;
+    jobs->fi = (nthreads > 1 || jobs->ring) ?
+		rpmfilesIter(files, RPMFI_ITER_FWD) : NULL;
+
+    return (jobs->fi != NULL);
+}
+
 static int fsmMkfile(int dirfd, rpmfi fi, struct filedata_s *fp, rpmfiles files,
 		     rpmpsm psm, int nodigest,
 		     struct filedata_s ** firstlink, int *firstlinkfile,
-		     int *firstdir, int *fdp)
+		     int *firstdir, int *fdp,
+		     struct fsmjobs_s *jobs, int *deferred, rpmop syncop)
 {
     int rc = 0;
     int fd = -1;
@@ -221,15 +656,25 @@ static int fsmMkfile(int dirfd, rpmfi fi, struct filedata_s *fp, rpmfiles files,
 
     /* If the file has content, unpack it */
     if (rpmfiArchiveHasContent(fi)) {
-	if (!rc)
-	    rc = fsmUnpack(fi, fd, psm, nodigest);
+	if (!rc) {
+	    /* Small files can be written out by a worker thread */
+	    if (jobs && rpmfiFSize(fi) <= _jobMaxFileSize) {
+		rc = fsmJobQueue(jobs, fi, fp, fd, files, psm, nodigest);
+		*deferred = (rc == 0);
+	    } else {
+		rc = fsmUnpack(fi, fd, psm, nodigest);
+	    }
+	}
 	/* Last file of hardlink set, ensure metadata gets set */
 	if (*firstlink) {
 	    fp->setmeta = 1;
 	    *firstlink = NULL;
 	    *firstlinkfile = -1;
-	    fsmClose(firstdir);
+	    fsmClose(firstdir, syncop);
 	}
+	/* The job owns the file descriptor now */
+	if (*deferred)
+	    fd = -1;
     }
     *fdp = fd;
 
@@ -337,8 +782,11 @@ static int fsmOpenat(int *wfdp, int dirfd, const char *path, int flags, int dir)
     if (!rc && fd < 0)
 	rc = RPMERR_OPEN_FAILED;
 
-    if (rc)
-	fsmClose(&fd);
+    /* Never handed out, nothing to flush */
+    if (rc && fd >= 0) {
+	close(fd);
+	fd = -1;
+    }
 
     *wfdp = fd;
     return rc;
@@ -380,7 +828,7 @@ static int fsmDoMkDir(rpmPlugins plugins, int dirfd, const char *dn,
 }
 
 static int ensureDir(rpmPlugins plugins, const char *p, int owned, int create,
-		    int quiet, int *dirfdp)
+		    int quiet, int *dirfdp, rpmop syncop)
 {
     char *sp = NULL, *bn;
     char *apath = NULL;
@@ -406,7 +854,7 @@ static int ensureDir(rpmPlugins plugins, const char *p, int owned, int create,
 	    rc = fsmDoMkDir(plugins, dirfd, bn, apath, owned, mode, &fd);
 	}
 
-	fsmClose(&dirfd);
+	fsmClose(&dirfd, syncop);
 	if (rc)
 	    break;
 
@@ -421,8 +869,8 @@ static int ensureDir(rpmPlugins plugins, const char *p, int owned, int create,
 		    bn, p, msg);
 	    free(msg);
 	}
-	fsmClose(&fd);
-	fsmClose(&dirfd);
+	fsmClose(&fd, syncop);
+	fsmClose(&dirfd, syncop);
     }
     *dirfdp = dirfd;
 
@@ -847,13 +1295,14 @@ static void setFileState(rpmfs fs, int i)
 struct diriter_s {
     int dirfd;
     int firstdir;
+    rpmop syncop;
 };
 
 static int onChdir(rpmfi fi, void *data)
 {
     struct diriter_s *di = (struct diriter_s *)data;
 
-    fsmClose(&(di->dirfd));
+    fsmClose(&(di->dirfd), di->syncop);
     return 0;
 }
 
@@ -871,11 +1320,46 @@ static rpmfi fsmIter(FD_t payload, rpmfiles files, rpmFileIter iter, void *data)
 
 static rpmfi fsmIterFini(rpmfi fi, struct diriter_s *di)
 {
-    fsmClose(&(di->dirfd));
-    fsmClose(&(di->firstdir));
+    fsmClose(&(di->dirfd), di->syncop);
+    fsmClose(&(di->firstdir), di->syncop);
     return rpmfiFree(fi);
 }
 
+/* Remember the filesystem of a directory for syncing it later */
+static void fsmSyncAdd(std::unordered_map<dev_t,int> & syncfds, int dirfd)
+{
+    struct stat sb;
+
+    if (fstat(dirfd, &sb) == 0 && syncfds.find(sb.st_dev) == syncfds.end()) {
+	int fd = dup(dirfd);
+	if (fd >= 0)
+	    syncfds[sb.st_dev] = fd;
+    }
+}
+
+/* Sync the remembered filesystems */
+static void fsmSyncFs(std::unordered_map<dev_t,int> & syncfds, rpmop syncop)
+{
+#ifndef HAVE_SYNCFS
+    if (!syncfds.empty()) {
+	(void) rpmswEnter(syncop, 0);
+	sync();
+	(void) rpmswExit(syncop, 0);
+    }
+#endif
+    for (auto & entry : syncfds) {
+#ifdef HAVE_SYNCFS
+	(void) rpmswEnter(syncop, 0);
+	if (syncfs(entry.second))
+	    rpmlog(RPMLOG_WARNING, _("syncing filesystem failed: %s\n"),
+		   strerror(errno));
+	(void) rpmswExit(syncop, 0);
+#endif
+	close(entry.second);
+    }
+    syncfds.clear();
+}
+
 int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
               rpmpsm psm, char ** failedFile)
 {
@@ -892,7 +1376,14 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
     char *tid = NULL;
     struct filedata_s *fdata = (struct filedata_s *)xcalloc(fc, sizeof(*fdata));
     struct filedata_s *firstlink = NULL;
-    struct diriter_s di = { -1, -1 };
+    struct rpmop_s synced = {};
+    struct diriter_s di = { -1, -1, &synced };
+    struct fsmjobs_s jobs;
+    int threaded = fsmJobsInit(&jobs, files, &synced);
+    int syncpkg = (fsmFlushMode() == FLUSH_PACKAGE);
+    std::unordered_map<dev_t,int> syncfds;
+    int dx = -1;
+    struct rpmop_s created = {};
 
     /* transaction id used for temporary path suffix while installing */
     rasprintf(&tid, ";%08x", (unsigned)rpmtsGetTid(ts));
@@ -935,9 +1426,21 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
         goto exit;
     }
 
-    /* Process the payload */
+    /*
+     * Process the payload. Decompression and all namespace operations
+     * happen here in payload order, optionally handing the content of
+     * regular files to be written and verified in worker threads.
+     */
+    #pragma omp parallel num_threads(jobs.nthreads) if (threaded)
+    #pragma omp master
+    {
+#ifdef ENABLE_OPENMP
+    /* The team can be smaller than asked for, don't wait on idle tasks */
+    jobs.nthreads = omp_get_num_threads();
+#endif
     while (!rc && (fx = rpmfiNext(fi)) >= 0) {
 	struct filedata_s *fp = &fdata[fx];
+	int deferred = 0;
 
 	/*
 	 * Tricksy case: this file is a being skipped, but it's part of
@@ -952,7 +1455,7 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
 	    int mayopen = 0;
 	    int fd = -1;
 	    rc = ensureDir(plugins, rpmfiDN(fi), 0,
-			    (fp->action == FA_CREATE), 0, &di.dirfd);
+			    (fp->action == FA_CREATE), 0, &di.dirfd, &synced);
 
 	    /* Directories replacing something need early backup */
 	    if (!rc && !fp->suffix && fp != firstlink) {
@@ -994,7 +1497,8 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
 		if (rc == RPMERR_ENOENT) {
 		    rc = fsmMkfile(di.dirfd, fi, fp, files, psm, nodigest,
 				   &firstlink, &firstlinkfile, &di.firstdir,
-				   &fd);
+				   &fd, threaded ? &jobs : NULL, &deferred,
+				   &synced);
 		}
             } else if (S_ISDIR(fp->sb.st_mode)) {
                 if (rc == RPMERR_ENOENT) {
@@ -1028,6 +1532,9 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
 setmeta:
 	    /* Special files require path-based ops */
 	    mayopen = S_ISREG(fp->sb.st_mode) || S_ISDIR(fp->sb.st_mode);
+	    /* Deferred files get their metadata set once written out */
+	    if (deferred)
+		goto notify;
 	    if (!rc && fd == -1 && mayopen) {
 		int flags = O_RDONLY;
 		/* Only follow safe symlinks, and never on temporary files */
@@ -1044,21 +1551,37 @@ setmeta:
 	    }
 
 	    if (fd != firstlinkfile)
-		fsmClose(&fd);
+		fsmClose(&fd, &synced);
 	}
 
+notify:
 	/* Notify on success. */
 	if (rc)
 	    *failedFile = rstrscat(NULL, rpmfiDN(fi), fp->fpath, NULL);
 	else
 	    rpmpsmNotify(psm, RPMCALLBACK_INST_PROGRESS, rpmfiArchiveTell(fi));
 	fp->stage = FILE_UNPACK;
+
+	if (!rc && threaded)
+	    rc = fsmJobsReap(&jobs, files, plugins, nofcaps, 0, failedFile);
+    }
+
+    /* Wait for the writers, on failure too as they own open files */
+    if (threaded) {
+	int jrc = fsmJobsReap(&jobs, files, plugins, nofcaps, 1, failedFile);
+	if (!rc)
+	    rc = jrc;
     }
+    } /* omp master */
     fi = fsmIterFini(fi, &di);
 
     if (!rc && fx < 0 && fx != RPMERR_ITER_END)
 	rc = fx;
 
+    /* A staged payload can fail to decompress past the end of the archive */
+    if (!rc && payload)
+	rc = rpmtePayloadDone(te, payload);
+
     /* If all went well, commit files to final destination */
     fi = fsmIter(NULL, files, RPMFI_ITER_FWD, &di);
     while (!rc && (fx = rpmfiNext(fi)) >= 0) {
@@ -1066,7 +1589,7 @@ setmeta:
 
 	if (!fp->skip) {
 	    if (!rc)
-		rc = ensureDir(NULL, rpmfiDN(fi), 0, 0, 0, &di.dirfd);
+		rc = ensureDir(NULL, rpmfiDN(fi), 0, 0, 0, &di.dirfd, &synced);
 
 	    /* Backup file if needed. Directories are handled earlier */
 	    if (!rc && fp->suffix)
@@ -1075,10 +1598,21 @@ setmeta:
 	    if (!rc)
 		rc = fsmCommit(di.dirfd, &fp->fpath, fi, fp->action, fp->suffix);
 
-	    if (!rc)
+	    if (!rc && syncpkg && rpmfiDX(fi) != dx) {
+		dx = rpmfiDX(fi);
+		fsmSyncAdd(syncfds, di.dirfd);
+	    }
+
+	    if (!rc) {
 		fp->stage = FILE_COMMIT;
-	    else
+		if (fp->action != FA_TOUCH) {
+		    created.count++;
+		    if (S_ISREG(fp->sb.st_mode))
+			created.bytes += fp->sb.st_size;
+		}
+	    } else {
 		*failedFile = rstrscat(NULL, rpmfiDN(fi), fp->fpath, NULL);
+	    }
 
 	    /* Run fsm file post hook for all plugins for all processed files */
 	    rpmpluginsCallFsmFilePost(plugins, fi, fp->fpath,
@@ -1087,6 +1621,10 @@ setmeta:
     }
     fi = fsmIterFini(fi, &di);
 
+    /* Make the files durable before the package is added to the rpmdb */
+    if (!rc)
+	fsmSyncFs(syncfds, &synced);
+
     /* On failure, walk backwards and erase non-committed files */
     if (rc) {
 	fi = fsmIter(NULL, files, RPMFI_ITER_BACK, &di);
@@ -1094,7 +1632,7 @@ setmeta:
 	    struct filedata_s *fp = &fdata[fx];
 
 	    /* If the directory doesn't exist there's nothing to clean up */
-	    if (ensureDir(NULL, rpmfiDN(fi), 0, 0, 1, &di.dirfd))
+	    if (ensureDir(NULL, rpmfiDN(fi), 0, 0, 1, &di.dirfd, &synced))
 		continue;
 
 	    if (fp->stage > FILE_NONE && !fp->skip && fp->action != FA_TOUCH) {
@@ -1105,9 +1643,20 @@ setmeta:
 
     rpmswAdd(rpmtsOp(ts, RPMTS_OP_UNCOMPRESS), fdOp(payload, FDSTAT_READ));
     rpmswAdd(rpmtsOp(ts, RPMTS_OP_DIGEST), fdOp(payload, FDSTAT_DIGEST));
+    rpmswAdd(rpmteOp(te, RPMTS_OP_UNCOMPRESS), fdOp(payload, FDSTAT_READ));
+    rpmswAdd(rpmteOp(te, RPMTS_OP_DIGEST), fdOp(payload, FDSTAT_DIGEST));
+
+    rpmswAdd(rpmtsOp(ts, RPMTS_OP_FILES), &created);
+    rpmswAdd(rpmteOp(te, RPMTS_OP_FILES), &created);
 
 exit:
     fi = fsmIterFini(fi, &di);
+    rpmswAdd(rpmtsOp(ts, RPMTS_OP_FSYNC), &synced);
+    rpmswAdd(rpmteOp(te, RPMTS_OP_FSYNC), &synced);
+    rpmfiFree(jobs.fi);
+    fsmRingFree(jobs.ring);
+    for (auto & entry : syncfds)
+	close(entry.second);
     Fclose(payload);
     free(tid);
     for (int i = 0; i < fc; i++)
@@ -1121,7 +1670,8 @@ exit:
 int rpmPackageFilesRemove(rpmts ts, rpmte te, rpmfiles files,
               rpmpsm psm, char ** failedFile)
 {
-    struct diriter_s di = { -1, -1 };
+    struct rpmop_s synced = {};
+    struct diriter_s di = { -1, -1, &synced };
     rpmfi fi = fsmIter(NULL, files, RPMFI_ITER_BACK, &di);
     rpmfs fs = rpmteGetFileStates(te);
     rpmPlugins plugins = rpmtsPlugins(ts);
@@ -1139,7 +1689,7 @@ int rpmPackageFilesRemove(rpmts ts, rpmte te, rpmfiles files,
 
 	fp->fpath = fsmFsPath(fi, NULL);
 	/* If the directory doesn't exist there's nothing to clean up */
-	if (ensureDir(NULL, rpmfiDN(fi), 0, 0, 1, &di.dirfd))
+	if (ensureDir(NULL, rpmfiDN(fi), 0, 0, 1, &di.dirfd, &synced))
 	    continue;
 
 	rc = fsmStat(di.dirfd, fp->fpath, 1, &fp->sb);
@@ -1208,6 +1758,8 @@ int rpmPackageFilesRemove(rpmts ts, rpmte te, rpmfiles files,
 	free(fdata[i].fpath);
     free(fdata);
     fsmIterFini(fi, &di);
+    rpmswAdd(rpmtsOp(ts, RPMTS_OP_FSYNC), &synced);
+    rpmswAdd(rpmteOp(te, RPMTS_OP_FSYNC), &synced);
 
     return rc;
 }
@@ -2125,6 +2125,113 @@ rpmRC hdrblobGet(hdrblob blob, uint32_t tag, rpmtd td)
     return rc;
 }
 
+/*
+ * Copy a single on-disk entry into malloced storage, converting the data
+ * to host byte order. Returns 0 on success, -1 on error.
+ */
+static int entryImport(indexEntry entry, const struct entryInfo_s *pe,
+		       const unsigned char *dataStart,
+		       const unsigned char *dataEnd)
+{
+    struct indexEntry_s ie;
+    const unsigned char *src;
+
+    ei2h(pe, &ie.info);
+
+    if (hdrchkType(ie.info.type))
+	return -1;
+    if (hdrchkData(ie.info.count))
+	return -1;
+    if (hdrchkData(ie.info.offset))
+	return -1;
+    if (hdrchkAlign(ie.info.type, ie.info.offset))
+	return -1;
+
+    src = dataStart + ie.info.offset;
+    if (src >= dataEnd)
+	return -1;
+    if (dataLength(ie.info.type, src, ie.info.count, 1, dataEnd, &ie.length))
+	return -1;
+    if (hdrchkData(ie.length))
+	return -1;
+
+    ie.data = memcpy(xmalloc(ie.length), src, ie.length);
+    ie.info.offset = 0;
+    ie.rdlen = 0;
+
+    /* Perform endian conversions */
+    switch (ie.info.type) {
+    case RPM_INT64_TYPE:
+    {	uint64_t * it = (uint64_t *)ie.data;
+	for (uint32_t i = 0; i < ie.info.count; i++)
+	    it[i] = htonll(it[i]);
+    }	break;
+    case RPM_INT32_TYPE:
+    {	uint32_t * it = (uint32_t *)ie.data;
+	for (uint32_t i = 0; i < ie.info.count; i++)
+	    it[i] = htonl(it[i]);
+    }	break;
+    case RPM_INT16_TYPE:
+    {	uint16_t * it = (uint16_t *)ie.data;
+	for (uint32_t i = 0; i < ie.info.count; i++)
+	    it[i] = htons(it[i]);
+    }	break;
+    }
+
+    *entry = ie;	/* structure assignment */
+    return 0;
+}
+
+Header headerImportTags(const void * blob, unsigned int bsize,
+			const rpmTagVal * tags, int ntags)
+{
+    Header h = NULL;
+    struct hdrblob_s hblob;
+    char *buf = NULL;
+
+    /* Sanity checks on header intro. */
+    if (hdrblobInit(blob, bsize, 0, 0, &hblob, &buf) != RPMRC_OK)
+	goto exit;
+
+    h = headerCreate(NULL, 0);
+    for (uint32_t i = 0; i < hblob.il; i++) {
+	const struct entryInfo_s *pe = hblob.pe + i;
+	rpmTagVal tag = ntohl(pe->tag);
+	int wanted = 0;
+
+	for (int j = 0; j < ntags; j++) {
+	    if (tags[j] == tag) {
+		wanted = 1;
+		break;
+	    }
+	}
+	if (!wanted || (tag >= RPMTAG_HEADERIMAGE && tag < RPMTAG_HEADERREGIONS))
+	    continue;
+
+	/* Dribble entries replace duplicate region entries. */
+	(void) headerDel(h, tag);
+	if (i >= hblob.ril && tag == RPMTAG_BASENAMES)
+	    (void) headerDel(h, RPMTAG_OLDFILENAMES);
+
+	if (h->indexUsed == h->indexAlloced) {
+	    h->indexAlloced += INDEX_MALLOC_SIZE;
+	    h->index = xrealloc(h->index, h->indexAlloced * sizeof(*h->index));
+	}
+	if (entryImport(h->index + h->indexUsed, pe,
+			hblob.dataStart, hblob.dataEnd)) {
+	    h = headerFree(h);
+	    goto exit;
+	}
+	h->indexUsed++;
+	h->sorted = 0;
+    }
+    headerSort(h);
+
+exit:
+    free(buf);
+    return h;
+}
+
 Header headerImport(void * blob, unsigned int bsize, headerImportFlags flags)
 {
     Header h = NULL;
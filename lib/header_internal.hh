@@ -50,6 +50,22 @@ rpmRC hdrblobGet(hdrblob blob, uint32_t tag, rpmtd td);
 RPM_GNUC_INTERNAL
 void hdrblobDigestUpdate(rpmDigestBundle bundle, struct hdrblob_s *blob);
 
+/** \ingroup header
+ * Import selected tags from a header blob.
+ * Only the entries of the given tags are located, validated and converted
+ * to host byte order, everything else in the blob is ignored. The data is
+ * copied, the blob is not modified nor owned by the returned header.
+ * The resulting header has no immutable region.
+ * @param blob		header blob
+ * @param bsize		header blob size in bytes
+ * @param tags		array of tags to import
+ * @param ntags		number of tags in array
+ * @return		new header (NULL on error)
+ */
+RPM_GNUC_INTERNAL
+Header headerImportTags(const void * blob, unsigned int bsize,
+			const rpmTagVal * tags, int ntags);
+
 /** \ingroup header
  * Set header instance (rpmdb record number)
  * @param h		header
@@ -202,6 +202,13 @@ static sprintfToken hsaNext(headerSprintfArgs hsa)
  */
 static void hsaFini(headerSprintfArgs hsa)
 {
+    /* Restore the iteration marker consumed by hsaNext() for reuse */
+    if (hsa->hi != NULL) {
+	sprintfTag tag = (hsa->format->type == PTOK_TAG
+			    ? &hsa->format->u.tag
+			    : &hsa->format->u.array.format->u.tag);
+	tag->tag = -2;
+    }
     hsa->hi = headerFreeIterator(hsa->hi);
     hsa->i = 0;
 }
@@ -872,56 +879,172 @@ static bool singleSprintf(headerSprintfArgs hsa, sprintfToken token,
     return false;
 }
 
-char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg) 
+static int addFormatTag(rpmTagVal tag, std::vector<rpmTagVal> & tags)
+{
+    if (tag == -2)
+	return -1;
+
+    if (rpmHeaderTagFunc(tag)) {
+	const rpmTagVal *deps = rpmHeaderTagDeps(tag);
+	if (deps == NULL)
+	    return -1;
+	for (; *deps; deps++)
+	    tags.push_back(*deps);
+    } else {
+	tags.push_back(tag);
+    }
+    return 0;
+}
+
+static int formatTags(sprintfToken format, int numTokens,
+		      std::vector<rpmTagVal> & tags)
+{
+    for (int i = 0; i < numTokens; i++) {
+	sprintfToken token = format + i;
+	switch (token->type) {
+	case PTOK_TAG:
+	    if (addFormatTag(token->u.tag.tag, tags))
+		return -1;
+	    break;
+	case PTOK_ARRAY:
+	    if (formatTags(token->u.array.format,
+			   token->u.array.numTokens, tags))
+		return -1;
+	    break;
+	case PTOK_COND:
+	    if (addFormatTag(token->u.cond.tag.tag, tags))
+		return -1;
+	    if (formatTags(token->u.cond.ifFormat,
+			   token->u.cond.numIfTokens, tags))
+		return -1;
+	    if (formatTags(token->u.cond.elseFormat,
+			   token->u.cond.numElseTokens, tags))
+		return -1;
+	    break;
+	case PTOK_NONE:
+	case PTOK_STRING:
+	    break;
+	}
+    }
+    return 0;
+}
+
+int headerFormatTags(const char *fmt, std::vector<rpmTagVal> & tags)
 {
     struct headerSprintfArgs_s hsa {};
-    sprintfToken nextfmt;
-    sprintfTag tag;
- 
-    hsa.h = headerLink(h);
+    int rc = -1;
+
     hsa.fmt = xstrdup(fmt);
-    hsa.errmsg = NULL;
+    if (parseFormat(&hsa, hsa.fmt, &hsa.format, &hsa.numTokens, NULL, PARSER_BEGIN) == 0) {
+	rc = formatTags(hsa.format, hsa.numTokens, tags);
+	hsa.format = freeFormat(hsa.format, hsa.numTokens);
+    }
+    free(hsa.fmt);
+    return rc;
+}
 
-    if (parseFormat(&hsa, hsa.fmt, &hsa.format, &hsa.numTokens, NULL, PARSER_BEGIN))
-	goto exit;
+/**
+ * A compiled query format: the parsed format and the per-header state
+ * which is reused from one header to the next.
+ */
+struct headerFormatter_s {
+    struct headerSprintfArgs_s hsa;
+};
+
+headerFormatter headerFormatterNew(const char * fmt, errmsg_t * errmsg)
+{
+    headerFormatter hf = new headerFormatter_s {};
+    headerSprintfArgs hsa = &hf->hsa;
+    sprintfTag tag;
+
+    hsa->fmt = xstrdup(fmt ? fmt : "");
+    hsa->errmsg = NULL;
+
+    if (parseFormat(hsa, hsa->fmt, &hsa->format, &hsa->numTokens, NULL, PARSER_BEGIN)) {
+	if (errmsg)
+	    *errmsg = hsa->errmsg;
+	return headerFormatterFree(hf);
+    }
 
     tag =
-	(hsa.format->type == PTOK_TAG
-	    ? &hsa.format->u.tag :
-	(hsa.format->type == PTOK_ARRAY
-	    ? &hsa.format->u.array.format->u.tag :
+	(hsa->format->type == PTOK_TAG
+	    ? &hsa->format->u.tag :
+	(hsa->format->type == PTOK_ARRAY
+	    ? &hsa->format->u.array.format->u.tag :
 	NULL));
     if (tag != NULL && tag->tag == -2 && tag->type != NULL) {
 	if (rstreq(tag->type, "xml"))
-	    hsa.xfmt = xformat_xml; /* struct assignment */
+	    hsa->xfmt = xformat_xml; /* struct assignment */
 	else if (rstreq(tag->type, "json"))
-	    hsa.xfmt = xformat_json; /* struct assignment */
+	    hsa->xfmt = xformat_json; /* struct assignment */
     }
 
-    if (hsa.xfmt.xHeader)
-	hsa.xfmt.xHeader(&hsa);
+    if (errmsg)
+	*errmsg = NULL;
+    return hf;
+}
 
-    hsaInit(&hsa);
-    while ((nextfmt = hsaNext(&hsa)) != NULL) {
-	if (singleSprintf(&hsa, nextfmt, 0)) {
-	    hsa.val = "";
+headerFormatter headerFormatterFree(headerFormatter hf)
+{
+    if (hf) {
+	headerSprintfArgs hsa = &hf->hsa;
+	hsa->format = freeFormat(hsa->format, hsa->numTokens);
+	hsa->fmt = _free(hsa->fmt);
+	delete hf;
+    }
+    return NULL;
+}
+
+const char * headerFormatterRender(headerFormatter hf, Header h,
+				   errmsg_t * errmsg)
+{
+    headerSprintfArgs hsa;
+    sprintfToken nextfmt;
+
+    if (hf == NULL)
+	return NULL;
+
+    hsa = &hf->hsa;
+    hsa->h = headerLink(h);
+    hsa->errmsg = NULL;
+    /* Keeps the capacity from previous headers */
+    hsa->val.clear();
+
+    if (hsa->xfmt.xHeader)
+	hsa->xfmt.xHeader(hsa);
+
+    hsaInit(hsa);
+    while ((nextfmt = hsaNext(hsa)) != NULL) {
+	if (singleSprintf(hsa, nextfmt, 0)) {
+	    hsa->val.clear();
 	    break;
 	}
     }
-    hsaFini(&hsa);
+    hsaFini(hsa);
 
-    if (hsa.xfmt.xFooter)
-	hsa.xfmt.xFooter(&hsa);
+    if (hsa->xfmt.xFooter)
+	hsa->xfmt.xFooter(hsa);
 
-    for (auto & val : hsa.cache)
+    for (auto & val : hsa->cache)
 	rpmtdFreeData(&val.second);
-    hsa.format = freeFormat(hsa.format, hsa.numTokens);
+    hsa->cache.clear();
+    hsa->h = headerFree(hsa->h);
 
-exit:
     if (errmsg)
-	*errmsg = hsa.errmsg;
-    hsa.h = headerFree(hsa.h);
-    hsa.fmt = _free(hsa.fmt);
-    return hsa.errmsg ? NULL : xstrdup(hsa.val.c_str());
+	*errmsg = hsa->errmsg;
+    return hsa->errmsg ? NULL : hsa->val.c_str();
 }
 
+char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg) 
+{
+    char *val = NULL;
+    headerFormatter hf = headerFormatterNew(fmt, errmsg);
+
+    if (hf) {
+	const char *str = headerFormatterRender(hf, h, errmsg);
+	if (str)
+	    val = xstrdup(str);
+	headerFormatterFree(hf);
+    }
+    return val;
+}
@@ -7,6 +7,7 @@
  */
 
 #include <string.h>
+#include <vector>
 #include <rpm/rpmtypes.h>
 #include <rpm/header.h>		/* for headerGetFlags typedef, duh.. */
 #include "rpmfs.hh"
@@ -28,6 +29,21 @@ typedef int (*headerTagTagFunction) (Header h, rpmtd td, headerGetFlags hgflags)
 RPM_GNUC_INTERNAL
 headerTagTagFunction rpmHeaderTagFunc(rpmTagVal tag);
 
+/*
+ * Return the zero-terminated list of header tags an extension tag is
+ * calculated from, or NULL if not known.
+ */
+RPM_GNUC_INTERNAL
+const rpmTagVal * rpmHeaderTagDeps(rpmTagVal tag);
+
+/*
+ * Collect the header tags needed to expand a query format into tags.
+ * Returns 0 on success, -1 if the format is invalid or the needed tags
+ * can't be determined (eg. iteration over all tags).
+ */
+RPM_GNUC_INTERNAL
+int headerFormatTags(const char *fmt, std::vector<rpmTagVal> & tags);
+
 RPM_GNUC_INTERNAL
 headerFmt rpmHeaderFormatByName(const char *fmt);
 
@@ -745,8 +745,10 @@ static rpmRC dbAdd(rpmts ts, rpmte te)
 	mergeAux(auxh, h);
 
     (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_DBADD), 0);
+    (void) rpmswEnter(rpmteOp(te, RPMTS_OP_DBADD), 0);
     rc = (rpmdbAdd(rpmtsGetRdb(ts), h) == 0) ? RPMRC_OK : RPMRC_FAIL;
     (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_DBADD), 0);
+    (void) rpmswExit(rpmteOp(te, RPMTS_OP_DBADD), 0);
 
     if (rc == RPMRC_OK) {
 	rpmteSetDBInstance(te, headerGetInstance(h));
@@ -762,9 +764,11 @@ static rpmRC dbRemove(rpmts ts, rpmte te)
     rpmRC rc;
 
     (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_DBREMOVE), 0);
+    (void) rpmswEnter(rpmteOp(te, RPMTS_OP_DBREMOVE), 0);
     rc = (rpmdbRemove(rpmtsGetRdb(ts), rpmteDBInstance(te)) == 0) ?
 						RPMRC_OK : RPMRC_FAIL;
     (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_DBREMOVE), 0);
+    (void) rpmswExit(rpmteOp(te, RPMTS_OP_DBREMOVE), 0);
 
     if (rc == RPMRC_OK)
 	rpmteSetDBInstance(te, 0);
@@ -843,6 +847,7 @@ static rpmRC rpmPackageInstall(rpmts ts, rpmpsm psm)
     int once = 1;
 
     rpmswEnter(rpmtsOp(psm->ts, RPMTS_OP_INSTALL), 0);
+    rpmswEnter(rpmteOp(psm->te, RPMTS_OP_INSTALL), 0);
     while (once--) {
 	/* HACK: replacepkgs abuses te instance to remove old header */
 	if (rpmtsFilterFlags(psm->ts) & RPMPROB_FILTER_REPLACEPKG)
@@ -933,6 +938,7 @@ static rpmRC rpmPackageInstall(rpmts ts, rpmpsm psm)
     }
 
     rpmswExit(rpmtsOp(psm->ts, RPMTS_OP_INSTALL), 0);
+    rpmswExit(rpmteOp(psm->te, RPMTS_OP_INSTALL), 0);
 
     return rc;
 }
@@ -943,6 +949,7 @@ static rpmRC rpmPackageErase(rpmts ts, rpmpsm psm)
     int once = 1;
 
     rpmswEnter(rpmtsOp(psm->ts, RPMTS_OP_ERASE), 0);
+    rpmswEnter(rpmteOp(psm->te, RPMTS_OP_ERASE), 0);
     while (once--) {
 
 	if (!(rpmtsFlags(ts) & RPMTRANS_FLAG_NOTRIGGERUN)) {
@@ -1021,6 +1028,7 @@ static rpmRC rpmPackageErase(rpmts ts, rpmpsm psm)
     }
 
     rpmswExit(rpmtsOp(psm->ts, RPMTS_OP_ERASE), 0);
+    rpmswExit(rpmteOp(psm->te, RPMTS_OP_ERASE), 0);
 
     return rc;
 }
@@ -1030,6 +1038,7 @@ static rpmRC rpmPackageRestore(rpmts ts, rpmpsm psm)
     rpmRC rc = RPMRC_OK;
 
     rpmswEnter(rpmtsOp(psm->ts, RPMTS_OP_INSTALL), 0);
+    rpmswEnter(rpmteOp(psm->te, RPMTS_OP_INSTALL), 0);
     rc = rpmChrootIn() ? RPMRC_FAIL : RPMRC_OK;
     if (rc == RPMRC_OK) {
 	char *failedFile = NULL;
@@ -1053,6 +1062,7 @@ static rpmRC rpmPackageRestore(rpmts ts, rpmpsm psm)
 	rpmChrootOut();
     }
     rpmswExit(rpmtsOp(psm->ts, RPMTS_OP_INSTALL), 0);
+    rpmswExit(rpmteOp(psm->te, RPMTS_OP_INSTALL), 0);
 
     return rc;
 }
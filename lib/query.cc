@@ -22,7 +22,9 @@
 #include <rpm/rpmstring.h>
 
 #include "rpmgi.hh"
+#include "rpmdb_internal.hh"
 #include "manifest.hh"
+#include "misc.hh"
 
 #include "debug.h"
 
@@ -101,15 +103,24 @@ int showQueryPackage(QVA_t qva, rpmts ts, Header h)
     time_t now = 0;
 
     if (qva->qva_queryFormat != NULL) {
-	const char *errstr;
-	char *str = headerFormat(h, qva->qva_queryFormat, &errstr);
+	const char *errstr = NULL;
+	const char *str = NULL;
+	/* Outside of rpmcliQuery(), compile the format just for this header */
+	headerFormatter hf = qva->qva_formatter;
+	if (hf == NULL)
+	    hf = headerFormatterNew(qva->qva_queryFormat, &errstr);
+
+	if (hf != NULL)
+	    str = headerFormatterRender(hf, h, &errstr);
 
 	if ( str != NULL ) {
 	    rpmlog(RPMLOG_NOTICE, "%s", str);
-	    free(str);
 	} else {
 	    rpmlog(RPMLOG_ERR, _("incorrect format: %s\n"), errstr);
 	}
+
+	if (hf != qva->qva_formatter)
+	    headerFormatterFree(hf);
     }
 
     /* Inclusion flags traditionally imply list mode */
@@ -279,6 +290,25 @@ static int rpmgiShowMatches(QVA_t qva, rpmts ts, rpmgi gi)
     return ec + rpmgiNumErrors(gi);
 }
 
+/*
+ * Plain queryformat output only needs the tags used in the format,
+ * let the iterator skip importing the rest of the headers.
+ */
+static void setQueryTags(QVA_t qva, rpmdbMatchIterator mi)
+{
+    std::vector<rpmTagVal> tags;
+
+    if (qva->qva_showPackage != showQueryPackage)
+	return;
+    if ((qva->qva_flags & _QUERY_FOR_BITS) || qva->qva_incattr)
+	return;
+    if (qva->qva_queryFormat == NULL)
+	return;
+
+    if (headerFormatTags(qva->qva_queryFormat, tags) == 0 && !tags.empty())
+	rpmdbSetIteratorTags(mi, tags.data(), tags.size());
+}
+
 static int rpmcliShowMatches(QVA_t qva, rpmts ts, rpmdbMatchIterator mi)
 {
     Header h;
@@ -287,6 +317,8 @@ static int rpmcliShowMatches(QVA_t qva, rpmts ts, rpmdbMatchIterator mi)
     if (mi == NULL)
 	return 1;
 
+    setQueryTags(qva, mi);
+
     while ((h = rpmdbNextIterator(mi)) != NULL) {
 	int rc;
 	if ((rc = qva->qva_showPackage(qva, ts, h)) != 0)
@@ -579,6 +611,10 @@ int rpmcliQuery(rpmts ts, QVA_t qva, char * const * argv)
 	qva->qva_queryFormat = fmt;
     }
 
+    /* The format is the same for all headers, only compile it once */
+    if (qva->qva_queryFormat != NULL)
+	qva->qva_formatter = headerFormatterNew(qva->qva_queryFormat, NULL);
+
     vsflags = rpmExpandNumeric("%{?_vsflags_query}");
     vsflags |= rpmcliVSFlags;
 
@@ -588,6 +624,7 @@ int rpmcliQuery(rpmts ts, QVA_t qva, char * const * argv)
 
     if (qva->qva_showPackage == showQueryPackage)
 	qva->qva_showPackage = NULL;
+    qva->qva_formatter = headerFormatterFree(qva->qva_formatter);
 
     return ec;
 }
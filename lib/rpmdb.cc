@@ -4,6 +4,7 @@
 
 #include "system.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -44,16 +45,213 @@
 using std::unordered_map;
 using std::vector;
 
+typedef rpmRC (*hdrchkFunc) (rpmts ts, const void *uh, size_t uc, char ** msg);
+
+static int pkgdbOpen(rpmdb db, int flags, dbiIndex *dbip);
+static bool validHeader(Header h);
+
+#define BULK_BATCH	64	/* headers per thread in a bulk load batch */
+
+/* A header blob read from the database for bulk processing */
+struct bulkhdr_s {
+    unsigned int offset;	/*!< header instance */
+    unsigned char *uh;		/*!< header blob (copy) */
+    unsigned int uhlen;		/*!< header blob length */
+    rpmRC chkrc;		/*!< header check result */
+    char *msg;			/*!< header check message */
+    Header h;			/*!< imported header, NULL if damaged */
+    bool valid;			/*!< header has the required tags */
+    void *blob;			/*!< re-exported header blob (optional) */
+    unsigned int bloblen;	/*!< re-exported header blob length */
+};
+
+typedef int (*bulkFunc) (rpmdb db, struct bulkhdr_s *bh, void *data);
+
+/* Number of threads for bulk header import */
+static int bulkThreads(void)
+{
+    int nthreads = rpmExpandNumeric("%{?_rebuilddb_nthreads}");
+
+    if (nthreads < 0)
+	nthreads = rpmExpandNumeric("%{getncpus:thread}");
+#ifndef ENABLE_OPENMP
+    nthreads = 1;
+#endif
+    if (nthreads < 1)
+	nthreads = 1;
+    return nthreads;
+}
+
+/* Check, import and optionally re-export a header blob, in a worker thread */
+static void bulkImport(struct bulkhdr_s *bh, rpmts ts, hdrchkFunc hdrchk,
+			int reexport)
+{
+    bh->chkrc = RPMRC_NOTFOUND;
+    if (ts && hdrchk)
+	bh->chkrc = hdrchk(ts, bh->uh, bh->uhlen, &bh->msg);
+    if (bh->chkrc == RPMRC_FAIL)
+	return;
+
+    bh->h = headerImport(bh->uh, bh->uhlen, HEADERIMPORT_FAST);
+    if (bh->h == NULL)
+	return;
+
+    /* The blob is owned by the header now */
+    bh->uh = NULL;
+    if (!headerIsEntry(bh->h, RPMTAG_NAME)) {
+	bh->h = headerFree(bh->h);
+	return;
+    }
+
+    bh->valid = validHeader(bh->h);
+    if (bh->valid && reexport)
+	bh->blob = headerExport(bh->h, &bh->bloblen);
+}
+
+/*
+ * Read all headers of a database, passing them to func() in database
+ * order. The blobs are read in batches from this thread, as cursors
+ * are not thread-safe, but checked with hdrchk() and imported in
+ * parallel. Headers failing the check or the import are skipped like
+ * rpmdbNextIterator() does. Iteration stops when func() returns non-zero.
+ */
+static int bulkLoad(rpmdb db, rpmts ts, hdrchkFunc hdrchk, int reexport,
+		    bulkFunc func, void *data)
+{
+    dbiIndex dbi = NULL;
+    dbiCursor dbc = NULL;
+    int nthreads = bulkThreads();
+    std::vector<rpmts> chkts;
+    std::vector<struct bulkhdr_s> batch;
+    unsigned int nread = 0;
+    int owned = 0;
+    int eof = 0;
+    int rc = 0;
+
+    if (pkgdbOpen(db, 0, &dbi))
+	return -1;
+    owned = (dbiFlags(dbi) & DBI_BLOBCOPY);
+
+    /*
+     * The checks update the operation stats of their transaction set,
+     * give each worker one of its own sharing the verification setup.
+     */
+    if (ts && hdrchk) {
+	if (nthreads > 1) {
+	    rpmKeyring keyring = rpmtsGetKeyring(ts, 1);
+	    for (int i = 0; i < nthreads; i++) {
+		rpmts cts = rpmtsCreate();
+		rpmtsSetVSFlags(cts, rpmtsVSFlags(ts));
+		rpmtsSetKeyring(cts, keyring);
+		chkts.push_back(cts);
+	    }
+	    rpmKeyringFree(keyring);
+	} else {
+	    chkts.push_back(ts);
+	}
+    }
+
+    dbc = dbiCursorInit(dbi, 0);
+    while (rc == 0 && !eof) {
+	unsigned char *uh = NULL;
+	unsigned int uhlen = 0;
+
+	batch.clear();
+	while (batch.size() < (size_t)nthreads * BULK_BATCH) {
+	    if (pkgdbGet(dbi, dbc, 0, &uh, &uhlen)) {
+		eof = 1;
+		break;
+	    }
+	    unsigned int offset = pkgdbKey(dbi, dbc);
+	    if (offset == 0) {
+		if (owned)
+		    free(uh);
+		if (nread++) {
+		    eof = 1;
+		    break;
+		}
+		continue;
+	    }
+	    nread++;
+
+	    struct bulkhdr_s bh = {};
+	    bh.offset = offset;
+	    bh.uhlen = uhlen;
+	    if (owned)
+		bh.uh = uh;
+	    else
+		bh.uh = (unsigned char *)memcpy(xmalloc(uhlen), uh, uhlen);
+	    batch.push_back(bh);
+	}
+
+	int nt = nthreads;
+	#pragma omp parallel for schedule(static, 1) num_threads(nt) if (nt > 1)
+	for (int t = 0; t < nt; t++) {
+	    rpmts cts = chkts.empty() ? NULL : chkts[t];
+	    for (size_t i = t; i < batch.size(); i += nt)
+		bulkImport(&batch[i], cts, hdrchk, reexport);
+	}
+
+	for (auto & bh : batch) {
+	    if (bh.chkrc != RPMRC_NOTFOUND) {
+		int lvl = (bh.chkrc == RPMRC_FAIL ? RPMLOG_ERR : RPMLOG_DEBUG);
+		rpmlog(lvl, "%s h#%8u %s\n",
+		    (bh.chkrc == RPMRC_FAIL ?
+			_("rpmdbNextIterator: skipping") : " read"),
+		    bh.offset, (bh.msg ? bh.msg : ""));
+	    }
+	    if (bh.h == NULL && bh.chkrc != RPMRC_FAIL) {
+		rpmlog(RPMLOG_ERR,
+			_("rpmdb: damaged header #%u retrieved -- skipping.\n"),
+			bh.offset);
+	    }
+	    if (bh.h && rc == 0) {
+		headerSetInstance(bh.h, bh.offset);
+		rc = func(db, &bh, data);
+	    }
+	    headerFree(bh.h);
+	    free(bh.blob);
+	    free(bh.msg);
+	    free(bh.uh);
+	}
+    }
+    dbiCursorFree(dbi, dbc);
+
+    if (chkts.size() > 1) {
+	for (auto cts : chkts)
+	    rpmtsFree(cts);
+    }
+
+    return rc;
+}
+
+/* Add a header to all secondary indexes which need building */
+static int buildIndex(rpmdb db, struct bulkhdr_s *bh, void *data)
+{
+    int *rcp = (int *)data;
+    int rebuild = (db->db_flags & RPMDB_FLAG_REBUILD);
+
+    /* Build all secondary indexes which were created on open */
+    for (int dbix = 0; dbix < db->db_ndbi; dbix++) {
+	dbiIndex dbi = db->db_indexes[dbix];
+	if (dbi && (rebuild || (dbiFlags(dbi) & DBI_CREATED))) {
+	    *rcp += idxdbPut(dbi, db->db_tags[dbix], bh->offset, bh->h);
+	}
+    }
+    return 0;
+}
+
 static int buildIndexes(rpmdb db)
 {
     int rc = 0;
-    Header h;
-    rpmdbMatchIterator mi;
+    int xx = 0;
 
     rc += rpmdbOpenAll(db);
 
-    /* If the main db was just created, this is expected - dont whine */
-    if (!(dbiFlags(db->db_pkgs) & DBI_CREATED)) {
+    /* If the main db was just created or is being rebuilt, this is
+     * expected - dont whine */
+    if (!(db->db_flags & RPMDB_FLAG_REBUILD) &&
+	!(dbiFlags(db->db_pkgs) & DBI_CREATED)) {
 	rpmlog(RPMLOG_WARNING,
 	       _("Generating %d missing index(es), please wait...\n"),
 	       db->db_buildindex);
@@ -66,18 +264,8 @@ static int buildIndexes(rpmdb db)
 
     dbCtrl(db, DB_CTRL_LOCK_RW);
 
-    mi = rpmdbInitIterator(db, RPMDBI_PACKAGES, NULL, 0);
-    while ((h = rpmdbNextIterator(mi))) {
-	unsigned int hdrNum = headerGetInstance(h);
-	/* Build all secondary indexes which were created on open */
-	for (int dbix = 0; dbix < db->db_ndbi; dbix++) {
-	    dbiIndex dbi = db->db_indexes[dbix];
-	    if (dbi && (dbiFlags(dbi) & DBI_CREATED)) {
-		rc += idxdbPut(dbi, db->db_tags[dbix], hdrNum, h);
-	    }
-	}
-    }
-    rpmdbFreeIterator(mi);
+    rc += bulkLoad(db, NULL, NULL, 0, buildIndex, &xx);
+    rc += xx;
 
     dbCtrl(db, DB_CTRL_INDEXSYNC);
     dbCtrl(db, DB_CTRL_UNLOCK_RW);
@@ -266,7 +454,7 @@ struct rpmdbMatchIterator_s {
     miRE		mi_re;
     rpmts		mi_ts;
     rpmRC (*mi_hdrchk) (rpmts ts, const void * uh, size_t uc, char ** msg);
-
+    vector<rpmTagVal>	mi_tags;	/* tags to import (empty for all) */
 };
 
 struct rpmdbIndexIterator_s {
@@ -348,6 +536,9 @@ int rpmdbClose(rpmdb db)
     if (db == NULL || --db->nrefs > 0)
 	goto exit;
 
+    /* Don't lose a pending batch, closing would roll it back */
+    rc += rpmdbBatchEnd(db);
+
     /* Always re-enable fsync on close of rw-database */
     if ((db->db_mode & O_ACCMODE) != O_RDONLY)
 	dbSetFSync(db, 1);
@@ -988,6 +1179,13 @@ unsigned int rpmdbGetIteratorOffsetFor(rpmdbMatchIterator mi, unsigned int ix)
     return 0;
 }
 
+unsigned int rpmdbGetIteratorFileNumFor(rpmdbMatchIterator mi, unsigned int ix)
+{
+    if (mi && mi->mi_set && ix < dbiIndexSetCount(mi->mi_set))
+	return dbiIndexRecordFileNumber(mi->mi_set, ix);
+    return 0;
+}
+
 /**
  * Return pattern match.
  * @param mire		match iterator regex
@@ -1213,9 +1411,42 @@ int rpmdbSetIteratorRE(rpmdbMatchIterator mi, rpmTagVal tag,
     if (mi->mi_nre > 1)
 	qsort(mi->mi_re, mi->mi_nre, sizeof(*mi->mi_re), mireCmp);
 
+    /* Selectors need their tag in partially imported headers */
+    if (!mi->mi_tags.empty())
+	mi->mi_tags.push_back(tag);
+
     return rc;
 }
 
+int rpmdbSetIteratorTags(rpmdbMatchIterator mi,
+			 const rpmTagVal * tags, int ntags)
+{
+    if (mi == NULL)
+	return 1;
+
+    mi->mi_tags.clear();
+    if (tags == NULL || ntags <= 0)
+	return 0;
+
+    /* Regions can't be imported partially */
+    for (int i = 0; i < ntags; i++) {
+	if (tags[i] >= RPMTAG_HEADERIMAGE && tags[i] < RPMTAG_HEADERREGIONS)
+	    return 1;
+    }
+
+    mi->mi_tags.assign(tags, tags + ntags);
+    /* Name is used for sanity checking every header */
+    mi->mi_tags.push_back(RPMTAG_NAME);
+    for (int i = 0; i < mi->mi_nre; i++)
+	mi->mi_tags.push_back(mi->mi_re[i].tag);
+
+    std::sort(mi->mi_tags.begin(), mi->mi_tags.end());
+    auto last = std::unique(mi->mi_tags.begin(), mi->mi_tags.end());
+    mi->mi_tags.erase(last, mi->mi_tags.end());
+
+    return 0;
+}
+
 /**
  * Return iterator selector match.
  * @param mi		rpm database iterator
@@ -1366,9 +1597,9 @@ Header rpmdbNextIterator(rpmdbMatchIterator mi)
     if (pkgdbOpen(mi->mi_db, 0, &dbi))
 	return NULL;
 
-#if defined(_USE_COPY_LOAD)
-    importFlags |= HEADERIMPORT_COPY;
-#endif
+    /* Take over blobs the backend copied for us, copy the others */
+    if (!(dbiFlags(dbi) & DBI_BLOBCOPY))
+	importFlags |= HEADERIMPORT_COPY;
     /*
      * Cursors are per-iterator, not per-dbi, so get a cursor for the
      * iterator on 1st call. If the iteration is to rewrite headers,
@@ -1393,15 +1624,23 @@ top:
 		mi->mi_offset = pkgdbKey(dbi, mi->mi_dbc);
 
 	    /* Terminate on error or end of keys */
-	    if (rc || (mi->mi_setx && mi->mi_offset == 0))
+	    if (rc || (mi->mi_setx && mi->mi_offset == 0)) {
+		if (rc == 0 && !(importFlags & HEADERIMPORT_COPY))
+		    free(uh);
 		return NULL;
+	    }
+	    if (mi->mi_offset == 0 && !(importFlags & HEADERIMPORT_COPY))
+		uh = _free(uh);
 	}
 	mi->mi_setx++;
     } while (mi->mi_offset == 0);
 
     /* If next header is identical, return it now. */
-    if (mi->mi_prevoffset && mi->mi_offset == mi->mi_prevoffset)
+    if (mi->mi_prevoffset && mi->mi_offset == mi->mi_prevoffset) {
+	if (!(importFlags & HEADERIMPORT_COPY))
+	    free(uh);
 	return mi->mi_h;
+    }
 
     /* Retrieve next header blob for index iterator. */
     if (uh == NULL) {
@@ -1419,11 +1658,24 @@ top:
 
     /* Verify header if enabled, skip damaged and inconsistent headers */
     if (miVerifyHeader(mi, uh, uhlen) == RPMRC_FAIL) {
+	if (!(importFlags & HEADERIMPORT_COPY))
+	    free(uh);
 	goto top;
     }
 
     /* Did the header blob load correctly? */
-    mi->mi_h = headerImport(uh, uhlen, importFlags);
+    if (!mi->mi_tags.empty() && !(mi->mi_cflags & DBC_WRITE)) {
+	/* Partial import always copies, the blob is ours if not a copy load */
+	mi->mi_h = headerImportTags(uh, uhlen,
+				    mi->mi_tags.data(), mi->mi_tags.size());
+	if (!(importFlags & HEADERIMPORT_COPY))
+	    free(uh);
+    } else {
+	mi->mi_h = headerImport(uh, uhlen, importFlags);
+	/* On failure, the blob is still ours */
+	if (mi->mi_h == NULL && !(importFlags & HEADERIMPORT_COPY))
+	    free(uh);
+    }
     if (mi->mi_h == NULL || !headerIsEntry(mi->mi_h, RPMTAG_NAME)) {
 	rpmlog(RPMLOG_ERR,
 		_("rpmdb: damaged header #%u retrieved -- skipping.\n"),
@@ -1915,6 +2167,75 @@ static void logAddRemove(const char *dbiname, int removing, rpmtd tagdata)
     }
 }
 
+int rpmdbBatchBegin(rpmdb db, int size)
+{
+    int rc = 0;
+
+    if (db == NULL || db->db_batch || size == 0 || size == 1)
+	return 0;
+    if ((db->db_mode & O_ACCMODE) == O_RDONLY)
+	return 0;
+    if (pkgdbOpen(db, 0, NULL))
+	return 1;
+
+    rpmsqBlock(SIG_BLOCK);
+    rc = dbCtrl(db, DB_CTRL_BATCH_BEGIN);
+    rpmsqBlock(SIG_UNBLOCK);
+
+    if (rc == 0) {
+	db->db_batch = size;
+	db->db_batched = 0;
+	rpmlog(RPMLOG_DEBUG, "batching database changes (%d per commit)\n",
+		size);
+    }
+    return (rc != 0);
+}
+
+int rpmdbBatchEnd(rpmdb db)
+{
+    int rc = 0;
+
+    if (db == NULL || db->db_batch == 0)
+	return 0;
+
+    rpmsqBlock(SIG_BLOCK);
+    rc = dbCtrl(db, DB_CTRL_BATCH_COMMIT);
+    rpmsqBlock(SIG_UNBLOCK);
+
+    if (rc)
+	rpmlog(RPMLOG_ERR, _("failed to commit database changes\n"));
+    /* An earlier failed commit is an error even if this one succeeded */
+    if (db->db_batcherr)
+	rc = 1;
+
+    db->db_batch = 0;
+    db->db_batched = 0;
+    db->db_batcherr = 0;
+    return (rc != 0);
+}
+
+/* Account a package change in the current batch, commit if it's full */
+static void batchNext(rpmdb db)
+{
+    if (db->db_batch == 0)
+	return;
+    if (db->db_batch > 0 && ++db->db_batched >= db->db_batch) {
+	if (dbCtrl(db, DB_CTRL_BATCH_COMMIT)) {
+	    /*
+	     * The batch is still open: don't nest another one in it, keep
+	     * adding to it and leave the commit to rpmdbBatchEnd().
+	     */
+	    rpmlog(RPMLOG_ERR, _("failed to commit database changes, "
+				 "no longer batching\n"));
+	    db->db_batcherr = 1;
+	    db->db_batch = -1;
+	} else if (dbCtrl(db, DB_CTRL_BATCH_BEGIN)) {
+	    db->db_batch = 0;
+	}
+	db->db_batched = 0;
+    }
+}
+
 int rpmdbRemove(rpmdb db, unsigned int hdrNum)
 {
     dbiIndex dbi = NULL;
@@ -1962,6 +2283,7 @@ int rpmdbRemove(rpmdb db, unsigned int hdrNum)
 
     dbCtrl(db, DB_CTRL_INDEXSYNC);
     dbCtrl(db, DB_CTRL_UNLOCK_RW);
+    batchNext(db);
     rpmsqBlock(SIG_UNBLOCK);
 
     headerFree(h);
@@ -2218,6 +2540,7 @@ int rpmdbAdd(rpmdb db, Header h)
 
     dbCtrl(db, DB_CTRL_INDEXSYNC);
     dbCtrl(db, DB_CTRL_UNLOCK_RW);
+    batchNext(db);
     rpmsqBlock(SIG_UNBLOCK);
 
     /* If everything ok, mark header as installed now */
@@ -2358,6 +2681,37 @@ static int rpmdbSetPermissions(char * src, char * dest)
     return rc;
 }
 
+/* State of the Packages pass of a database rebuild */
+struct rebuild_s {
+    dbiIndex dbi;
+    dbiCursor dbc;
+};
+
+/* Write a header from the old database into the new Packages table */
+static int rebuildAdd(rpmdb olddb, struct bulkhdr_s *bh, void *data)
+{
+    struct rebuild_s *rb = (struct rebuild_s *)data;
+    unsigned int hdrNum = 0;
+
+    /* let's sanity check this record a bit, otherwise just skip it */
+    if (!bh->valid) {
+	rpmlog(RPMLOG_ERR,
+		_("header #%u in the database is bad -- skipping.\n"),
+		bh->offset);
+	return 0;
+    }
+
+    if (bh->blob == NULL || bh->bloblen == 0 ||
+	pkgdbPut(rb->dbi, rb->dbc, &hdrNum,
+		 (unsigned char *)bh->blob, bh->bloblen))
+    {
+	rpmlog(RPMLOG_ERR, _("cannot add record originally at %u\n"),
+	       bh->offset);
+	return 1;
+    }
+    return 0;
+}
+
 int rpmdbRebuild(const char * prefix, rpmts ts,
 		rpmRC (*hdrchk) (rpmts ts, const void *uh, size_t uc, char ** msg),
 		int rebuildflags)
@@ -2412,38 +2766,32 @@ int rpmdbRebuild(const char * prefix, rpmts ts,
 	goto exit;
     }
 
-    {	Header h = NULL;
-	rpmdbMatchIterator mi;
-
-	mi = rpmdbInitIterator(olddb, RPMDBI_PACKAGES, NULL, 0);
-	if (ts && hdrchk)
-	    (void) rpmdbSetHdrChk(mi, ts, hdrchk);
-
-	while ((h = rpmdbNextIterator(mi)) != NULL) {
+    /*
+     * Bulk load: copy all headers into the new Packages table in one
+     * pass, then build the secondary indexes from it in another,
+     * instead of updating every index header by header.
+     */
+    {	struct rebuild_s rb = {};
 
-	    /* let's sanity check this record a bit, otherwise just skip it */
-	    if (!validHeader(h)) {
-		rpmlog(RPMLOG_ERR,
-			_("header #%u in the database is bad -- skipping.\n"),
-			rpmdbGetIteratorOffset(mi));
-		continue;
-	    }
+	if (pkgdbOpen(newdb, 0, &rb.dbi)) {
+	    failed = 1;
+	} else {
+	    rpmsqBlock(SIG_BLOCK);
+	    dbCtrl(newdb, DB_CTRL_LOCK_RW);
 
-	    rc = rpmdbAdd(newdb, h);
-	    if (rc) {
-		rpmlog(RPMLOG_ERR, _("cannot add record originally at %u\n"),
-		       rpmdbGetIteratorOffset(mi));
+	    rb.dbc = dbiCursorInit(rb.dbi, DBC_WRITE);
+	    if (bulkLoad(olddb, ts, hdrchk, 1, rebuildAdd, &rb))
 		failed = 1;
-		break;
-	    }
-	}
-
-	rpmdbFreeIterator(mi);
+	    dbiCursorFree(rb.dbi, rb.dbc);
 
+	    dbCtrl(newdb, DB_CTRL_UNLOCK_RW);
+	    rpmsqBlock(SIG_UNBLOCK);
+	}
     }
 
     rpmdbClose(olddb);
-    dbCtrl(newdb, DB_CTRL_INDEXSYNC);
+    if (!failed && buildIndexes(newdb))
+	failed = 1;
     rpmdbClose(newdb);
 
     if (failed) {
@@ -193,6 +193,20 @@ int rpmdbGetIteratorIndex(rpmdbMatchIterator mi);
 RPM_GNUC_INTERNAL
 void rpmdbSetIteratorIndex(rpmdbMatchIterator mi, unsigned int ix);
 
+/** \ingroup rpmdb
+ * Limit the tags imported from headers returned by the iterator.
+ * Headers returned by the iterator will only contain the given tags
+ * (plus the tags used by iterator selectors), skipping the cost of
+ * importing the rest of the header. Ignored on rewriting iterators.
+ * @param mi		rpm database iterator
+ * @param tags		array of tags to import (NULL for all)
+ * @param ntags		number of tags in array
+ * @return		0 on success, 1 on error
+ */
+RPM_GNUC_INTERNAL
+int rpmdbSetIteratorTags(rpmdbMatchIterator mi,
+			 const rpmTagVal * tags, int ntags);
+
 /** \ingroup rpmdb
  * Return offset of package with given index.
  * @param mi		rpm database iterator
@@ -202,6 +216,15 @@ void rpmdbSetIteratorIndex(rpmdbMatchIterator mi, unsigned int ix);
 RPM_GNUC_INTERNAL
 unsigned int rpmdbGetIteratorOffsetFor(rpmdbMatchIterator mi, unsigned int ix);
 
+/** \ingroup rpmdb
+ * Return file number (tag index) of index entry with given index.
+ * @param mi		rpm database iterator
+ * @param ix		index
+ * @return		file number
+ */
+RPM_GNUC_INTERNAL
+unsigned int rpmdbGetIteratorFileNumFor(rpmdbMatchIterator mi, unsigned int ix);
+
 /** \ingroup rpmdb
  * Return header located in rpmdb at given offset.
  * @param db		rpm database
@@ -211,4 +234,27 @@ unsigned int rpmdbGetIteratorOffsetFor(rpmdbMatchIterator mi, unsigned int ix);
 RPM_GNUC_INTERNAL
 Header rpmdbGetHeaderAt(rpmdb db, unsigned int offset);
 
+/** \ingroup rpmdb
+ * Start batching database changes: instead of committing every added
+ * or removed package separately, commit them in batches of given size.
+ * Changes in an uncommitted batch are not visible to other processes
+ * and are lost on crash. Only supported by the sqlite backend, a no-op
+ * on others.
+ * @param db		rpm database
+ * @param size		packages per commit (-1 for unlimited, 0 or 1
+ *			to commit every package separately)
+ * @return		0 on success, 1 on error
+ */
+RPM_GNUC_INTERNAL
+int rpmdbBatchBegin(rpmdb db, int size);
+
+/** \ingroup rpmdb
+ * Commit pending changes and stop batching database changes.
+ * @param db		rpm database
+ * @return		0 on success, 1 on error (including failed
+ *			commits while batching)
+ */
+RPM_GNUC_INTERNAL
+int rpmdbBatchEnd(rpmdb db);
+
 #endif
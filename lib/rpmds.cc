@@ -2,6 +2,7 @@
  * \file lib/rpmds.c
  */
 #include "system.h"
+#include <algorithm>
 #include <atomic>
 #include <string>
 #include <vector>
@@ -670,22 +671,6 @@ rpmds rpmdsInit(rpmds ds)
     return ds;
 }
 
-static rpmds rpmdsDup(const rpmds ods)
-{
-    rpmds ds = rpmdsCreate(ods->pool, ods->tagN, ods->Type,
-			   ods->Count, ods->instance);
-    
-    ds->i = ods->i;
-
-    ds->N = ods->N;
-    ds->EVR = ods->EVR;
-    ds->Flags = ods->Flags;
-    ds->ti = ods->ti;
-
-    return ds;
-
-}
-
 static int doFind(rpmds ds, const rpmds ods, unsigned int *he)
 {
     int comparison;
@@ -736,70 +721,195 @@ int rpmdsFind(rpmds ds, const rpmds ods)
     return doFind(ds, ods, NULL);
 }
 
-int rpmdsMerge(rpmds * dsp, rpmds ods)
+/* A dependency entry being merged, in the pool of the target set */
+struct mergeEntry {
+    rpmsid N;
+    rpmsid EVR;
+    const char *Nstr;
+    const char *EVRstr;
+    rpmsenseFlags Flags;
+    int ti;
+    rpm_color_t Color;
+};
+
+/* Same order as doFind(), ids are unique per string in a pool */
+static int mergeCmp(const mergeEntry & a, const mergeEntry & b)
+{
+    int rc = 0;
+
+    if (a.N != b.N)
+	rc = strcmp(a.Nstr, b.Nstr);
+    if (rc == 0 && a.EVR != b.EVR) {
+	if (a.EVRstr && b.EVRstr)
+	    rc = strcmp(a.EVRstr, b.EVRstr);
+	else
+	    rc = (a.EVRstr != NULL) - (b.EVRstr != NULL);
+    }
+    if (rc == 0 && a.Flags != b.Flags)
+	rc = (a.Flags < b.Flags) ? -1 : 1;
+    if (rc == 0 && a.ti != b.ti)
+	rc = (a.ti < b.ti) ? -1 : 1;
+    return rc;
+}
+
+int rpmdsMergeAll(rpmds * dsp, rpmds * odsv, int nods)
 {
     rpmds ds;
-    int save;
     int ocount;
+    vector<mergeEntry> add;
+    bool haveTi = false;
 
-    if (dsp == NULL || ods == NULL)
+    if (dsp == NULL || (nods > 0 && odsv == NULL))
 	return -1;
 
-    ocount = rpmdsCount(*dsp);
-
-    /* If not initialized yet, dup the 1st entry. */
+    /* If not initialized yet, create an empty set like the 1st one. */
     if (*dsp == NULL) {
-	save = ods->Count;
-	ods->Count = 1;
-	*dsp = rpmdsDup(ods);
-	ods->Count = save;
+	for (int i = 0; i < nods && *dsp == NULL; i++) {
+	    rpmds ods = odsv[i];
+	    if (ods)
+		*dsp = rpmdsCreate(ods->pool, ods->tagN, ods->Type,
+				   0, ods->instance);
+	}
     }
     ds = *dsp;
     if (ds == NULL)
-	return -1;
-
-    /* Ensure EVR and Flags exist */
-    if (ds->EVR.empty())
-	ds->EVR.assign(ds->Count, 0);
-    if (ds->Flags.empty())
-	ds->Flags.assign(ds->Count, 0);
-    if (ds->ti.empty() && ods->ti.empty() == false)
-	ds->ti.assign(ds->Count, -1);
+	return (nods > 0) ? -1 : 0;
+    ocount = ds->Count;
 
-    /*
-     * Add new entries.
-     */
-    save = ods->i;
-    ods = rpmdsInit(ods);
-    while (rpmdsNext(ods) >= 0) {
-	unsigned int u;
-	/*
-	 * If this entry is already present, don't bother.
-	 */
-	if (doFind(ds, ods, &u) >= 0)
+    /* Collect the new entries, in the pool of the merged set. */
+    for (int i = 0; i < nods; i++) {
+	rpmds ods = odsv[i];
+	if (ods == NULL)
 	    continue;
+	if (!ods->ti.empty())
+	    haveTi = true;
+	if (ods->pool != ds->pool)
+	    rpmstrPoolUnfreeze(ds->pool);
+	for (int j = 0; j < ods->Count; j++) {
+	    rpmsid N = rpmdsNIdIndex(ods, j);
+	    rpmsid EVR = rpmdsEVRIdIndex(ods, j);
+	    if (ods->pool != ds->pool) {
+		N = rpmstrPoolId(ds->pool, rpmdsNIndex(ods, j), 1);
+		EVR = rpmstrPoolId(ds->pool, rpmdsEVRIndex(ods, j), 1);
+	    }
+	    add.push_back({N, EVR, NULL, NULL, rpmdsFlagsIndex(ods, j),
+			   rpmdsTiIndex(ods, j), 0});
+	}
+    }
+    if (add.empty())
+	return 0;
 
-	/*
-	 * Insert new entry. Ensure pool is unfrozen to allow additions.
-	 */
-	rpmstrPoolUnfreeze(ds->pool);
-	ds->N.insert(ds->N.begin() + u,
-			rpmstrPoolId(ds->pool, rpmdsN(ods), 1));
-	ds->EVR.insert(ds->EVR.begin() + u,
-			rpmstrPoolId(ds->pool, rpmdsEVR(ods), 1));
-	ds->Flags.insert(ds->Flags.begin() + u, rpmdsFlags(ods));
-
-	if (ds->ti.empty() == false || ods->ti.empty() == false)
-	    ds->ti.insert(ds->ti.begin() + u, rpmdsTi(ods));
+    /* The pool doesn't change anymore, look up the strings just once. */
+    for (auto & e : add) {
+	e.Nstr = rpmstrPoolStr(ds->pool, e.N);
+	e.EVRstr = rpmstrPoolStr(ds->pool, e.EVR);
+    }
 
-	ds->i = ds->Count;
-	ds->Count++;
+    /* Sort and deduplicate the new entries. */
+    auto less = [](const mergeEntry & a, const mergeEntry & b) {
+	return mergeCmp(a, b) < 0;
+    };
+    auto equal = [](const mergeEntry & a, const mergeEntry & b) {
+	return mergeCmp(a, b) == 0;
+    };
+    std::stable_sort(add.begin(), add.end(), less);
+    add.erase(std::unique(add.begin(), add.end(), equal), add.end());
+
+    /* Find the insertion points in the (sorted) existing entries. */
+    vector<std::pair<int,const mergeEntry *>> ins;
+    int lo = 0;
+    for (auto const & e : add) {
+	int l = lo, u = ocount;
+	int rc = 1;
+	while (l < u) {
+	    int m = (l + u) / 2;
+	    mergeEntry o = { rpmdsNIdIndex(ds, m), rpmdsEVRIdIndex(ds, m),
+			     rpmdsNIndex(ds, m), rpmdsEVRIndex(ds, m),
+			     rpmdsFlagsIndex(ds, m), rpmdsTiIndex(ds, m), 0 };
+	    rc = mergeCmp(e, o);
+	    if (rc < 0)
+		u = m;
+	    else if (rc > 0)
+		l = m + 1;
+	    else
+		break;
+	}
+	/* If this entry is already present, don't bother. */
+	if (rc == 0)
+	    continue;
+	ins.push_back({l, &e});
+	lo = l;
+    }
+    if (ins.empty())
+	return 0;
 
+    /* Ensure EVR, Flags and ti exist */
+    haveTi |= !ds->ti.empty();
+    ds->N.resize(ocount);
+    ds->EVR.resize(ocount, 0);
+    ds->Flags.resize(ocount, 0);
+    ds->ti.resize(haveTi ? ocount : 0, -1);
+    if (!ds->Color.empty())
+	ds->Color.resize(ocount, 0);
+
+    /* Insert the new entries in a single pass. */
+    vector<rpmsid> N, EVR;
+    vector<rpmsenseFlags> Flags;
+    vector<int> ti;
+    vector<rpm_color_t> Color;
+    int count = ocount + ins.size();
+    N.reserve(count);
+    EVR.reserve(count);
+    Flags.reserve(count);
+    ti.reserve(haveTi ? count : 0);
+    Color.reserve(ds->Color.empty() ? 0 : count);
+
+    auto copy = [](auto & dst, auto const & src, int from, int to) {
+	dst.insert(dst.end(), src.begin() + from, src.begin() + to);
+    };
+    auto copyAll = [&](int from, int to) {
+	copy(N, ds->N, from, to);
+	copy(EVR, ds->EVR, from, to);
+	copy(Flags, ds->Flags, from, to);
+	if (haveTi)
+	    copy(ti, ds->ti, from, to);
+	if (!ds->Color.empty())
+	    copy(Color, ds->Color, from, to);
+    };
+
+    int prev = 0;
+    for (auto const & [ix, e] : ins) {
+	copyAll(prev, ix);
+	N.push_back(e->N);
+	EVR.push_back(e->EVR);
+	Flags.push_back(e->Flags);
+	if (haveTi)
+	    ti.push_back(e->ti);
+	if (!ds->Color.empty())
+	    Color.push_back(e->Color);
+	prev = ix;
     }
-    ods->i = save;
+    copyAll(prev, ocount);
+
+    ds->N = std::move(N);
+    ds->EVR = std::move(EVR);
+    ds->Flags = std::move(Flags);
+    ds->ti = std::move(ti);
+    if (!ds->Color.empty())
+	ds->Color = std::move(Color);
+    ds->Count = count;
+    ds->DNEVR.clear();
+
     return (ds->Count - ocount);
 }
 
+int rpmdsMerge(rpmds * dsp, rpmds ods)
+{
+    if (dsp == NULL || ods == NULL)
+	return -1;
+    return rpmdsMergeAll(dsp, &ods, 1);
+}
+
 
 int rpmdsSearch(rpmds ds, rpmds ods)
 {
@@ -855,30 +965,16 @@ int rpmdsSearch(rpmds ds, rpmds ods)
     return i;
 }
 
-int rpmdsCompareIndex(rpmds A, int aix, rpmds B, int bix)
+/* Compare the versioned ranges of two dependencies with the same name */
+static int evrOverlap(const char *AEVR, rpmsenseFlags AFlags,
+		      const char *BEVR, rpmsenseFlags BFlags)
 {
-    const char *AEVR, *BEVR;
-    rpmsenseFlags AFlags, BFlags;
     int result;
 
-    /* Different names don't overlap. */
-    if (!rpmstrPoolStreq(A->pool, rpmdsNIdIndex(A, aix),
-			 B->pool, rpmdsNIdIndex(B, bix))) {
-	result = 0;
-	goto exit;
-    }
-
-    /* Same name. If either A or B is an existence test, always overlap. */
-    AFlags = rpmdsFlagsIndex(A, aix);
-    BFlags = rpmdsFlagsIndex(B, bix);
+    /* If either A or B is an existence test, always overlap. */
     if (!((AFlags & RPMSENSE_SENSEMASK) && (BFlags & RPMSENSE_SENSEMASK))) {
 	result = 1;
-	goto exit;
-    }
-
-    AEVR = rpmdsEVRIndex(A, aix);
-    BEVR = rpmdsEVRIndex(B, bix);
-    if (!(AEVR && *AEVR && BEVR && *BEVR)) {
+    } else if (!(AEVR && *AEVR && BEVR && *BEVR)) {
 	/* If either EVR is non-existent or empty, always overlap. */
 	result = 1;
     } else {
@@ -892,15 +988,54 @@ int rpmdsCompareIndex(rpmds A, int aix, rpmds B, int bix)
 	rpmverFree(bv);
     }
 
-exit:
     return result;
 }
 
+int rpmdsCompareIndex(rpmds A, int aix, rpmds B, int bix)
+{
+    /* Different names don't overlap. */
+    if (!rpmstrPoolStreq(A->pool, rpmdsNIdIndex(A, aix),
+			 B->pool, rpmdsNIdIndex(B, bix)))
+	return 0;
+
+    return evrOverlap(rpmdsEVRIndex(A, aix), rpmdsFlagsIndex(A, aix),
+		      rpmdsEVRIndex(B, bix), rpmdsFlagsIndex(B, bix));
+}
+
 int rpmdsCompare(const rpmds A, const rpmds B)
 {
     return rpmdsCompareIndex(A, A->i, B, B->i);
 }
 
+/*
+ * Compare a single provide of a header to a dependency. This reads
+ * the provide straight from the header data, without creating a
+ * dependency set and adding all the provides to a string pool.
+ */
+static int matchesIndex(Header h, int prix, rpmds req)
+{
+    struct rpmtd_s names, evrs, flags;
+    int result = 0;
+
+    headerGet(h, RPMTAG_PROVIDENAME, &names, HEADERGET_MINMEM);
+    headerGet(h, RPMTAG_PROVIDEVERSION, &evrs, HEADERGET_MINMEM);
+    headerGet(h, RPMTAG_PROVIDEFLAGS, &flags, HEADERGET_MINMEM);
+
+    if (evrs.count == names.count && flags.count == names.count &&
+	    rpmtdSetIndex(&names, prix) >= 0 &&
+	    rstreq(rpmtdGetString(&names), rpmdsN(req))) {
+	rpmtdSetIndex(&evrs, prix);
+	rpmtdSetIndex(&flags, prix);
+	result = evrOverlap(rpmtdGetString(&evrs), *rpmtdGetUint32(&flags),
+			    rpmdsEVR(req), rpmdsFlags(req));
+    }
+
+    rpmtdFreeData(&names);
+    rpmtdFreeData(&evrs);
+    rpmtdFreeData(&flags);
+    return result;
+}
+
 int rpmdsMatches(rpmstrPool pool, Header h, int prix,
 		 rpmds req, int selfevr)
 {
@@ -908,6 +1043,10 @@ int rpmdsMatches(rpmstrPool pool, Header h, int prix,
     rpmTagVal tag = RPMTAG_PROVIDENAME;
     int result = 0;
 
+    /* An indexed provide only needs that one provide */
+    if (prix >= 0 && !selfevr)
+	return matchesIndex(h, prix, req);
+
     /* Get provides information from header */
     if (selfevr)
 	provides = rpmdsThisPool(pool, h, tag, RPMSENSE_EQUAL);
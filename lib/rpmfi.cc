@@ -2325,20 +2325,38 @@ ssize_t rpmfiArchiveRead(rpmfi fi, void * buf, size_t size)
     return rpmcpioRead(fi->archive, buf, size);
 }
 
+int rpmfilesVerifyDigest(rpmfiles fi, int ix, const void *digest)
+{
+    int digestalgo = rpmfilesDigestAlgo(fi);
+    const unsigned char * fidigest = rpmfilesFDigest(fi, ix, NULL, NULL);
+    int rc = RPMERR_DIGEST_MISMATCH;
+
+    if (digest != NULL && fidigest != NULL) {
+	size_t diglen = rpmDigestLength(digestalgo);
+	if (memcmp(digest, fidigest, diglen) == 0) {
+	    rc = 0;
+	} else if (rpmfilesFSize(fi, ix) == 0 && digestalgo == RPM_HASH_MD5) {
+	    /* ...but in old packages, empty files have zeros for digest */
+	    std::vector<uint8_t> zeros(diglen, 0);
+	    if (memcmp(zeros.data(), fidigest, diglen) == 0)
+		rc = 0;
+	}
+    }
+    return rc;
+}
+
 int rpmfiArchiveReadToFilePsm(rpmfi fi, FD_t fd, int nodigest, rpmpsm psm)
 {
     if (fi == NULL || fi->archive == NULL || fd == NULL)
 	return -1;
 
     rpm_loff_t left = rpmfiFSize(fi);
-    const unsigned char * fidigest = NULL;
     int digestalgo = 0;
     int rc = 0;
     char buf[BUFSIZ*4];
 
     if (!nodigest) {
 	digestalgo = rpmfiDigestAlgo(fi);
-	fidigest = rpmfilesFDigest(fi->files, rpmfiFX(fi), NULL, NULL);
 	fdInitDigest(fd, digestalgo, 0);
     }
 
@@ -2363,22 +2381,7 @@ int rpmfiArchiveReadToFilePsm(rpmfi fi, FD_t fd, int nodigest, rpmpsm psm)
 
 	(void) Fflush(fd);
 	fdFiniDigest(fd, digestalgo, &digest, NULL, 0);
-
-	if (digest != NULL && fidigest != NULL) {
-	    size_t diglen = rpmDigestLength(digestalgo);
-	    if (memcmp(digest, fidigest, diglen)) {
-		rc = RPMERR_DIGEST_MISMATCH;
-
-		/* ...but in old packages, empty files have zeros for digest */
-		if (rpmfiFSize(fi) == 0 && digestalgo == RPM_HASH_MD5) {
-		    std::vector<uint8_t> zeros(diglen, 0);
-		    if (memcmp(zeros.data(), fidigest, diglen) == 0)
-			rc = 0;
-		}
-	    }
-	} else {
-	    rc = RPMERR_DIGEST_MISMATCH;
-	}
+	rc = rpmfilesVerifyDigest(fi->files, rpmfiFX(fi), digest);
 	free(digest);
     }
 
@@ -94,6 +94,16 @@ RPM_GNUC_INTERNAL
 int rpmfileContentsEqual(rpmfiles ofi, int oix, rpmfiles nfi, int nix);
 
 
+/** \ingroup rpmfi
+ * Verify a calculated file digest against the one in the file info set.
+ * @param fi		file info set
+ * @param ix		file index
+ * @param digest	calculated digest (or NULL)
+ * @return		0 on match, RPMERR_DIGEST_MISMATCH otherwise
+ */
+RPM_GNUC_INTERNAL
+int rpmfilesVerifyDigest(rpmfiles fi, int ix, const void *digest);
+
 RPM_GNUC_INTERNAL
 rpmFileAction rpmfilesDecideFate(rpmfiles ofi, int oix,
 				   rpmfiles nfi, int nix,
@@ -25,6 +25,7 @@ struct rpmPlugin_s {
     void *handle;
     void *priv;
     rpmPluginHooks hooks;
+    rpmPluginHooksExt ext;	/*!< Optional extension hooks */
 };
 
 struct rpmPlugins_s {
@@ -92,6 +93,11 @@ static rpmPlugin rpmPluginNew(const char *name, const char *path,
 	plugin->hooks = hooks;
 	if (opts)
 	    plugin->opts = xstrdup(opts);
+
+	/* the extension hooks are optional */
+	free(hooks_name);
+	hooks_name = rstrscat(NULL, name, "_hooks_ext", NULL);
+	plugin->ext = (rpmPluginHooksExt)dlsym(handle, hooks_name);
     }
     free(hooks_name);
 
@@ -217,6 +223,18 @@ rpmPlugins rpmpluginsFree(rpmPlugins plugins)
 		   STR(hook), plugin->name); \
 	}
 
+/* Same for the extension hooks, which only exist up to the given size */
+#define RPMPLUGINS_SET_EXT_HOOK_FUNC(hook) \
+	rpmPluginHooksExt ext = (plugin != NULL) ? plugin->ext : NULL; \
+	hookFunc = NULL; \
+	if (ext != NULL && ext->size >= \
+		offsetof(struct rpmPluginHooksExt_s, hook) + sizeof(ext->hook)) \
+	    hookFunc = ext->hook; \
+	if (hookFunc) { \
+	    rpmlog(RPMLOG_DEBUG, "Plugin: calling hook %s in %s plugin\n", \
+		   STR(hook), plugin->name); \
+	}
+
 static rpmRC rpmpluginsCallInit(rpmPlugin plugin, rpmts ts)
 {
     rpmRC rc = RPMRC_OK;
@@ -261,6 +279,21 @@ rpmRC rpmpluginsCallTsmPost(rpmPlugins plugins, rpmts ts, int res)
     return rc;
 }
 
+rpmRC rpmpluginsCallTsmStats(rpmPlugins plugins, rpmts ts, int res)
+{
+    plugin_tsm_stats_func hookFunc;
+    rpmRC rc = RPMRC_OK;
+
+    for (auto & plugin : plugins->plugins) {
+	RPMPLUGINS_SET_EXT_HOOK_FUNC(tsm_stats);
+	if (hookFunc && hookFunc(plugin, ts, res) == RPMRC_FAIL) {
+	    rpmlog(RPMLOG_WARNING, "Plugin %s: hook tsm_stats failed\n", plugin->name);
+	}
+    }
+
+    return rc;
+}
+
 rpmRC rpmpluginsCallPsmPre(rpmPlugins plugins, rpmte te)
 {
     plugin_psm_pre_func hookFunc;
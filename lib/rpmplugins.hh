@@ -70,6 +70,16 @@ rpmRC rpmpluginsCallTsmPre(rpmPlugins plugins, rpmts ts);
 RPM_GNUC_INTERNAL
 rpmRC rpmpluginsCallTsmPost(rpmPlugins plugins, rpmts ts, int res);
 
+/** \ingroup rpmplugins
+ * Call the transaction statistics plugin hook
+ * @param plugins	plugins structure
+ * @param ts		processed transaction
+ * @param res		transaction result code
+ * @return		RPMRC_OK on success, RPMRC_FAIL otherwise
+ */
+RPM_GNUC_INTERNAL
+rpmRC rpmpluginsCallTsmStats(rpmPlugins plugins, rpmts ts, int res);
+
 /** \ingroup rpmplugins
  * Call the pre transaction element plugin hook
  * @param plugins	plugins structure
@@ -4,6 +4,8 @@
  */
 #include "system.h"
 
+#include <fcntl.h>
+#include <thread>
 #include <vector>
 #include <unordered_map>
 
@@ -16,9 +18,11 @@
 #include <rpm/rpmts.h>
 #include <rpm/rpmdb.h>
 #include <rpm/rpmlog.h>
+#include <rpm/rpmarchive.h>
 
 #include "misc.hh"
 #include "rpmplugins.hh"
+#include "rpmio_internal.hh"
 #include "rpmte_internal.hh"
 /* strpool-related interfaces */
 #include "rpmfi_internal.hh"
@@ -65,6 +69,9 @@ struct rpmte_s {
     int nrelocs;		/*!< (TR_ADDED) No. of relocations. */
     uint8_t *badrelocs;		/*!< (TR_ADDED) Bad relocations (or NULL) */
     FD_t fd;			/*!< (TR_ADDED) Payload file descriptor. */
+    FD_t payload;		/*!< (TR_ADDED) Staged payload (if any) */
+    std::thread stager;		/*!< (TR_ADDED) Payload staging thread */
+    int stagerc;		/*!< (TR_ADDED) Payload staging result */
     int vfylevel;		/*!< (TR_ADDED) Per-pkg verify level (if any) */
     int verified;		/*!< (TR_ADDED) Verification status */
     int addop;			/*!< (TR_ADDED) RPMTE_INSTALL/UPDATE/REINSTALL */
@@ -76,12 +83,15 @@ struct rpmte_s {
     int transscripts;		/*!< pre/posttrans script existence */
     int failed;			/*!< (parent) install/erase failed */
 
+    struct rpmop_s ops[RPMTS_OP_MAX];	/*!< Per-element statistics */
+
     rpmfs fs;
 };
 
 /* forward declarations */
 static void rpmteColorDS(rpmte te, rpmTag tag);
 static int rpmteClose(rpmte te, int reset_fi);
+static void rpmteStopStaging(rpmte te);
 
 void rpmteCleanDS(rpmte te)
 {
@@ -248,6 +258,7 @@ rpmte rpmteFree(rpmte te)
 	free(te->NEVR);
 	free(te->NEVRA);
 
+	rpmteStopStaging(te);
 	fdFree(te->fd);
 	rpmfilesFree(te->files);
 	headerFree(te->h);
@@ -615,6 +626,7 @@ static int rpmteClose(rpmte te, int reset_fi)
 
     switch (te->type) {
     case TR_ADDED:
+	rpmteStopStaging(te);
 	if (te->fd) {
 	    rpmtsNotify(te->ts, te, RPMCALLBACK_INST_CLOSE_FILE, 0, 0);
 	    te->fd = NULL;
@@ -636,7 +648,7 @@ static int rpmteClose(rpmte te, int reset_fi)
     return 1;
 }
 
-FD_t rpmtePayload(rpmte te)
+static FD_t rpmteOpenPayload(rpmte te)
 {
     FD_t payload = NULL;
     if (te->fd && te->h) {
@@ -648,6 +660,118 @@ FD_t rpmtePayload(rpmte te)
     return payload;
 }
 
+/*
+ * Decompress the payload into a pipe until done or the reader goes away.
+ * The result is returned in *rcp, the reader going away is not an error.
+ */
+static void stagePayload(FD_t payload, int wfd, int *rcp)
+{
+    std::vector<char> buf(128 * 1024);
+    ssize_t nb;
+    int rc = 0;
+
+    while ((nb = Fread(buf.data(), 1, buf.size(), payload)) > 0) {
+	const char *p = buf.data();
+	while (nb > 0) {
+	    ssize_t nw = write(wfd, p, nb);
+	    if (nw < 0) {
+		if (errno == EINTR)
+		    continue;
+		if (errno != EPIPE) {
+		    rpmlog(RPMLOG_ERR, _("payload staging failed: %s\n"),
+			    strerror(errno));
+		    rc = RPMERR_WRITE_FAILED;
+		}
+		goto exit;
+	    }
+	    p += nw;
+	    nb -= nw;
+	}
+    }
+
+    if (nb < 0) {
+	rpmlog(RPMLOG_ERR, _("payload decompression failed: %s\n"),
+		Fstrerror(payload));
+	rc = RPMERR_READ_FAILED;
+    }
+
+exit:
+    close(wfd);
+    Fclose(payload);
+    *rcp = rc;
+}
+
+/*
+ * Start decompressing the payload in the background, so it overlaps
+ * with plugin hooks, %pre and trigger scriptlets and writing out the
+ * files. The consumer reads the decompressed stream from a pipe.
+ */
+static void rpmteStagePayload(rpmte te)
+{
+    FD_t payload = NULL;
+    int pfd[2];
+
+    if (te->files == NULL || rpmfilesFC(te->files) == 0)
+	return;
+    if (rpmtsFlags(te->ts) & RPMTRANS_FLAG_JUSTDB)
+	return;
+    if (rpmExpandNumeric("%{?_install_readahead}") <= 0)
+	return;
+
+    if ((payload = rpmteOpenPayload(te)) == NULL)
+	return;
+
+    if (pipe2(pfd, O_CLOEXEC)) {
+	Fclose(payload);
+	return;
+    }
+
+    /* Larger pipe buffer lets the stager run further ahead, if permitted */
+    (void) fcntl(pfd[1], F_SETPIPE_SZ, 1024 * 1024);
+
+    te->payload = Fdopen(fdNew(pfd[0], NULL), "r.ufdio");
+    te->stagerc = 0;
+    te->stager = std::thread(stagePayload, payload, pfd[1], &te->stagerc);
+}
+
+static void rpmteStopStaging(rpmte te)
+{
+    /* Closing the pipe (if not already done) terminates the stager */
+    if (te->payload) {
+	Fclose(te->payload);
+	te->payload = NULL;
+    }
+    if (te->stager.joinable())
+	te->stager.join();
+}
+
+int rpmtePayloadDone(rpmte te, FD_t payload)
+{
+    char buf[BUFSIZ];
+
+    if (!te->stager.joinable())
+	return 0;
+
+    /* Let the stager run to the end, errors can turn up past the archive */
+    while (Fread(buf, 1, sizeof(buf), payload) > 0)
+	;
+    te->stager.join();
+    return te->stagerc;
+}
+
+FD_t rpmtePayload(rpmte te)
+{
+    FD_t payload = NULL;
+    if (te->payload) {
+	/* Ownership of staged payload passes to the caller */
+	payload = te->payload;
+	te->payload = NULL;
+    } else {
+	payload = rpmteOpenPayload(te);
+    }
+    return payload;
+}
+
 static int rpmteMarkFailed(rpmte te)
 {
     te->failed++;
@@ -813,6 +937,15 @@ int rpmteAddOp(rpmte te)
     return te->addop;
 }
 
+rpmop rpmteOp(rpmte te, rpmtsOpX opx)
+{
+    rpmop op = NULL;
+
+    if (te != NULL && opx >= 0 && opx < RPMTS_OP_MAX)
+	op = te->ops + opx;
+    return op;
+}
+
 int rpmteProcess(rpmte te, pkgGoal goal, int num)
 {
     /* Only install/erase resets pkg file info */
@@ -830,6 +963,8 @@ int rpmteProcess(rpmte te, pkgGoal goal, int num)
 	    rpmtsNotify(te->ts, te, RPMCALLBACK_ELEM_PROGRESS, num,
 			rpmtsMembers(te->ts)->order.size());
 	}
+	if (goal == PKG_INSTALL && !test)
+	    rpmteStagePayload(te);
 
 	failed = rpmpsmRun(te->ts, te, goal);
 	rpmteClose(te, reset_fi);
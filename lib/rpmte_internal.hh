@@ -65,6 +65,15 @@ FD_t rpmteSetFd(rpmte te, FD_t fd);
 RPM_GNUC_INTERNAL
 FD_t rpmtePayload(rpmte te);
 
+/** \ingroup rpmte
+ * Finish reading the payload and return the result of its staging.
+ * @param te		transaction element
+ * @param payload	payload returned by rpmtePayload()
+ * @return		0 on success (or if not staged), RPMERR_* on failure
+ */
+RPM_GNUC_INTERNAL
+int rpmtePayloadDone(rpmte te, FD_t payload);
+
 RPM_GNUC_INTERNAL
 int rpmteProcess(rpmte te, pkgGoal goal, int num);
 
@@ -538,6 +538,8 @@ void rpmtsEmpty(rpmts ts)
     /* The pool cannot be emptied, there might be references to its contents */
     tsmem->pool = rpmstrPoolFree(tsmem->pool);
     tsmem->removedPackages.clear();
+    /* ...and the cached results refer to it */
+    rpmtsFreeDepCache(ts);
     return;
 }
 
@@ -572,6 +574,132 @@ static void rpmtsPrintStats(rpmts ts)
     rpmtsPrintStat("dbget:       ", rpmtsOp(ts, RPMTS_OP_DBGET));
     rpmtsPrintStat("dbput:       ", rpmtsOp(ts, RPMTS_OP_DBPUT));
     rpmtsPrintStat("dbdel:       ", rpmtsOp(ts, RPMTS_OP_DBDEL));
+    rpmtsPrintStat("fsync:       ", rpmtsOp(ts, RPMTS_OP_FSYNC));
+    rpmtsPrintStat("files:       ", rpmtsOp(ts, RPMTS_OP_FILES));
+}
+
+static const struct opname_s {
+    rpmtsOpX op;
+    const char *name;
+} opNames[] = {
+    { RPMTS_OP_TOTAL,		"total" },
+    { RPMTS_OP_CHECK,		"check" },
+    { RPMTS_OP_ORDER,		"order" },
+    { RPMTS_OP_VERIFY,		"verify" },
+    { RPMTS_OP_FINGERPRINT,	"fingerprint" },
+    { RPMTS_OP_INSTALL,		"install" },
+    { RPMTS_OP_ERASE,		"erase" },
+    { RPMTS_OP_SCRIPTLETS,	"scriptlets" },
+    { RPMTS_OP_COMPRESS,	"compress" },
+    { RPMTS_OP_UNCOMPRESS,	"uncompress" },
+    { RPMTS_OP_DIGEST,		"digest" },
+    { RPMTS_OP_SIGNATURE,	"signature" },
+    { RPMTS_OP_DBADD,		"dbadd" },
+    { RPMTS_OP_DBREMOVE,	"dbremove" },
+    { RPMTS_OP_DBGET,		"dbget" },
+    { RPMTS_OP_DBPUT,		"dbput" },
+    { RPMTS_OP_DBDEL,		"dbdel" },
+    { RPMTS_OP_FSYNC,		"fsync" },
+    { RPMTS_OP_FILES,		"files" },
+};
+
+static void jsonPutString(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; s && *s; s++) {
+	unsigned char c = *s;
+	if (c == '"' || c == '\\')
+	    fprintf(f, "\\%c", c);
+	else if (c < 0x20)
+	    fprintf(f, "\\u%04x", c);
+	else
+	    fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static void jsonPutOps(FILE *f, int indent,
+			rpmop (*getop)(void *, rpmtsOpX), void *obj)
+{
+    const char *sep = "";
+
+    fprintf(f, "%*s\"ops\": {", indent, "");
+    for (auto const & on : opNames) {
+	rpmop op = getop(obj, on.op);
+	if (op == NULL || op->count <= 0)
+	    continue;
+	fprintf(f, "%s\n%*s\"%s\": "
+		"{ \"count\": %d, \"bytes\": %zu, \"usecs\": %lu }",
+		sep, indent + 2, "", on.name, op->count, op->bytes, op->usecs);
+	sep = ",";
+    }
+    fprintf(f, "\n%*s}\n", indent, "");
+}
+
+static rpmop tsOp(void *ts, rpmtsOpX opx)
+{
+    return rpmtsOp((rpmts)ts, opx);
+}
+
+static rpmop teOp(void *te, rpmtsOpX opx)
+{
+    return rpmteOp((rpmte)te, opx);
+}
+
+static int rpmtsWriteStats(rpmts ts, int res, const char *path)
+{
+    FILE *f = fopen(path, "w");
+    rpmtsi pi;
+    rpmte p;
+    const char *sep = "";
+
+    if (f == NULL)
+	return -1;
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"tid\": %u,\n", (unsigned)rpmtsGetTid(ts));
+    fprintf(f, "  \"result\": %d,\n", res);
+    fprintf(f, "  \"transaction\": {\n");
+    jsonPutOps(f, 4, tsOp, ts);
+    fprintf(f, "  },\n");
+    fprintf(f, "  \"elements\": [");
+
+    pi = rpmtsiInit(ts);
+    while ((p = rpmtsiNext(pi, 0)) != NULL) {
+	fprintf(f, "%s\n    {\n", sep);
+	fprintf(f, "      \"nevra\": ");
+	jsonPutString(f, rpmteNEVRA(p));
+	fprintf(f, ",\n");
+	fprintf(f, "      \"type\": \"%s\",\n",
+		rpmteType(p) == TR_ADDED ? "install" : "erase");
+	fprintf(f, "      \"failed\": %d,\n", rpmteFailed(p));
+	jsonPutOps(f, 6, teOp, p);
+	fprintf(f, "    }");
+	sep = ",";
+    }
+    rpmtsiFree(pi);
+    fprintf(f, "\n  ]\n}\n");
+
+    return fclose(f) ? -1 : 0;
+}
+
+void rpmtsReportStats(rpmts ts, int res)
+{
+    struct rpmop_s total = ts->ops[RPMTS_OP_TOTAL];
+    char *path = rpmGetPath("%{?_transaction_stats_path}", NULL);
+
+    /* The transaction total keeps running until rpmtsFree(), snapshot it */
+    (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_TOTAL), 0);
+
+    rpmpluginsCallTsmStats(rpmtsPlugins(ts), ts, res);
+
+    if (*path && rpmtsWriteStats(ts, res, path)) {
+	rpmlog(RPMLOG_WARNING, _("failed to write transaction statistics "
+				 "to %s: %s\n"), path, strerror(errno));
+    }
+
+    ts->ops[RPMTS_OP_TOTAL] = total;
+    free(path);
 }
 
 rpmts rpmtsFree(rpmts ts)
@@ -680,6 +808,7 @@ int rpmtsSetRootDir(rpmts ts, const char * rootDir)
     }
 
     ts->rootDir = _free(ts->rootDir);
+    rpmtsFreeDepCache(ts);
     /* Ensure clean path with a trailing slash */
     ts->rootDir = rootDir ? rpmGetPath(rootDir, NULL) : xstrdup("/");
     if (!rstreq(ts->rootDir, "/")) {
@@ -937,6 +1066,18 @@ static int vfylevel_init(void)
     return vfylevel;
 }
 
+static int minWritesInit(void)
+{
+    int mw = rpmExpandNumeric("%{?_minimize_writes}%{!?_minimize_writes:-1}");
+
+    if (mw > 0)
+	return MINWRITES_ON;
+    /* Autodetect: reinstalls are expected to carry mostly identical files */
+    if (mw < 0)
+	return MINWRITES_REINSTALL;
+    return MINWRITES_OFF;
+}
+
 rpmts rpmtsCreate(void)
 {
     rpmts ts = new rpmts_s {};
@@ -1002,7 +1143,7 @@ rpmts rpmtsCreate(void)
     ts->nrefs = 0;
 
     ts->plugins = NULL;
-    ts->min_writes = (rpmExpandNumeric("%{?_minimize_writes}") > 0);
+    ts->min_writes = minWritesInit();
 
     return rpmtsLink(ts);
 }
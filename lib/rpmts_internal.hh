@@ -33,6 +33,16 @@ struct diskspaceInfo {
     int rotational;	/*!< Rotational media? */
 };
 
+/* Values of %_minimize_writes */
+enum minWrites_e {
+    MINWRITES_OFF	= 0,	/*!< Always write out files */
+    MINWRITES_REINSTALL	= 1,	/*!< Skip identical files on reinstall */
+    MINWRITES_ON	= 2,	/*!< Skip identical files on all updates */
+};
+
+/* Dependency check results, defined in depends.cc */
+struct depCache;
+
 /* Transaction set elements information */
 typedef struct tsMembers_s {
     rpmstrPool pool;		/*!< Global string pool */
@@ -98,7 +108,9 @@ struct rpmts_s {
 
     rpmtriggers trigs2run;   /*!< Transaction file triggers */
 
-    int min_writes;             /*!< macro minimize_writes used */
+    int min_writes;             /*!< From %{_minimize_writes} */
+
+    depCache *depcache;		/*!< rpmdb lookups kept across checks */
 
     time_t overrideTime;	/*!< Time value used when overriding system clock. */
     int scriptError;		/*!< scriptlet error tracking */
@@ -124,6 +136,10 @@ rpmdbMatchIterator rpmtsPrunedIterator(rpmts ts, rpmDbiTagVal tag,
 RPM_GNUC_INTERNAL
 rpmdbMatchIterator rpmtsTeIterator(rpmts ts, rpmte te, int prune);
 
+/* Forget the cached dependency check results */
+RPM_GNUC_INTERNAL
+void rpmtsFreeDepCache(rpmts ts);
+
 RPM_GNUC_INTERNAL
 rpmal rpmtsCreateAl(rpmts ts, rpmElementTypes types);
 
@@ -145,6 +161,10 @@ int rpmtsNotifyChange(rpmts ts, int event, rpmte te, rpmte other);
 RPM_GNUC_INTERNAL
 rpm_time_t rpmtsGetTime(rpmts ts, time_t step);
 
+/* Pass transaction statistics to plugins and %_transaction_stats_path */
+RPM_GNUC_INTERNAL
+void rpmtsReportStats(rpmts ts, int res);
+
 RPM_GNUC_INTERNAL
 rpmts rpmtxnTs(rpmtxn txn);
 
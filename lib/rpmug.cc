@@ -2,7 +2,6 @@
 
 #include <unordered_map>
 #include <string>
-#include <vector>
 
 #include <pwd.h>
 #include <grp.h>
@@ -20,6 +19,16 @@
 using std::unordered_map;
 using std::string;
 
+struct ugfile_s {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    time_t ctime;
+    unordered_map<string,long> ids;
+    unordered_map<long,string> names;
+};
+
 struct rpmug_s {
     // Empty path means use system lookup
     char *pwpath;
@@ -28,6 +37,8 @@ struct rpmug_s {
     unordered_map<gid_t,string> gidMap;
     unordered_map<string,uid_t> unameMap;
     unordered_map<string,gid_t> gnameMap;
+    // Parsed passwd/group files by path
+    unordered_map<string,ugfile_s> files;
 };
 
 static __thread struct rpmug_s *rpmug = NULL;
@@ -62,106 +73,138 @@ static const char *grpfile(void)
     return getpath("group", "/etc/group", &rpmug->grppath);
 }
 
+/* atol() with error handling, return 0/-1 on success/failure */
+static int stol(const char *s, long *ret)
+{
+    int rc = 0;
+    char *end = NULL;
+    long val = strtol(s, &end, 10);
+
+    /* only accept fully numeric data */
+    if (*s == '\0' || *end != '\0')
+	rc = -1;
+
+    if ((val == LONG_MIN || val == LONG_MAX) && errno == ERANGE)
+	rc = -1;
+
+    if (rc == 0)
+	*ret = val;
+
+    return rc;
+}
+
+static bool ugfileChanged(const struct ugfile_s *uf, const struct stat *sb)
+{
+    return (uf->dev != sb->st_dev || uf->ino != sb->st_ino ||
+	    uf->size != sb->st_size || uf->mtime != sb->st_mtime ||
+	    uf->ctime != sb->st_ctime);
+}
+
 /*
- * Lookup an arbitrary field based on contents of another in a ':' delimited
- * file, such as /etc/passwd or /etc/group.
+ * Parse a ':' delimited file such as /etc/passwd or /etc/group into
+ * name <-> id maps. The result is cached until the file is replaced or
+ * modified, eg by a scriptlet creating users in the middle of a transaction.
  */
-static int lookup_field_in_file(const char *path, const char *val, int vcol, int rcol,
-			char **ret)
+static const struct ugfile_s *ugfileGet(const char *path)
 {
-    int rc = -1; /* assume not found */
-    char *str, buf[BUFSIZ];
-    FILE *f = fopen(path, "r");
-    if (f == NULL) {
+    struct ugfile_s *uf = NULL;
+    struct stat sb;
+    char *line = NULL;
+    size_t lsize = 0;
+    FILE *f = NULL;
+
+    auto it = rpmug->files.find(path);
+    if (stat(path, &sb) == 0) {
+	if (it != rpmug->files.end() && !ugfileChanged(&it->second, &sb))
+	    return &it->second;
+	f = fopen(path, "r");
+    }
+
+    if (it != rpmug->files.end())
+	rpmug->files.erase(it);
+
+    if (f == NULL || fstat(fileno(f), &sb)) {
 	rpmlog(RPMLOG_ERR, _("failed to open %s for id/name lookup: %s\n"),
 		path, strerror(errno));
-	return rc;
+	goto exit;
     }
 
-    while ((str = fgets(buf, sizeof(buf), f)) != NULL) {
-	int nf = vcol > rcol ? vcol : rcol;
-	std::vector<const char *> fields(nf + 1);
-	int col = -1;
+    uf = &rpmug->files[path];
+    uf->dev = sb.st_dev;
+    uf->ino = sb.st_ino;
+    uf->size = sb.st_size;
+    uf->mtime = sb.st_mtime;
+    uf->ctime = sb.st_ctime;
+
+    while (getline(&line, &lsize, f) >= 0) {
+	/* name:password:id[:...] */
+	char *fields[3];
+	char *s = line;
+	int nf;
+	long id;
 
-	ARGV_t tokens = argvSplitString(str, ":", ARGV_NONE);
-	for (ARGV_const_t tok = tokens; tok && *tok; tok++) {
-	    fields[++col] = *tok;
-	    if (col >= nf)
-		break;
+	line[strcspn(line, "\n")] = '\0';
+	for (nf = 0; nf < 3 && s; nf++) {
+	    fields[nf] = s;
+	    s = strchr(s, ':');
+	    if (s)
+		*s++ = '\0';
 	}
 
-	if (col >= nf) {
-	    if (rstreq(val, fields[vcol])) {
-		*ret = xstrdup(fields[rcol]);
-		rc = 0;
-	    }
-	}
-	argvFree(tokens);
-    }
+	if (nf < 3 || stol(fields[2], &id))
+	    continue;
 
-    fclose(f);
+	/* last entry wins */
+	uf->ids[fields[0]] = id;
+	uf->names[id] = fields[0];
+    }
 
-    return rc;
+exit:
+    if (f)
+	fclose(f);
+    free(line);
+    return uf;
 }
 
 /*
- * Lookup an arbitrary field based on contents of another in a ':' delimited
- * file, such as /etc/passwd or /etc/group. Look at multiple files listed in
- * path separated by colons
+ * Look up a name or an id from multiple files listed in path separated by
+ * colons, files are consulted in the given order until a match is found.
  */
-static int lookup_field(const char *path, const char *val, int vcol, int rcol,
-			char **ret)
+static int lookup_id(const char *path, const char *name, long *ret)
 {
     ARGV_t paths = argvSplitString(path, ":", ARGV_SKIPEMPTY);
     int rc = -1;
     for (ARGV_t p = paths; *p; p++) {
-	rc = lookup_field_in_file(*p, val, vcol, rcol, ret);
-	if (!rc)
+	const struct ugfile_s *uf = ugfileGet(*p);
+	if (uf == NULL)
+	    continue;
+	auto it = uf->ids.find(name);
+	if (it != uf->ids.end()) {
+	    *ret = it->second;
+	    rc = 0;
 	    break;
+	}
     }
     argvFree(paths);
     return rc;
 }
 
-/* atol() with error handling, return 0/-1 on success/failure */
-static int stol(const char *s, long *ret)
-{
-    int rc = 0;
-    char *end = NULL;
-    long val = strtol(s, &end, 10);
-
-    /* only accept fully numeric data */
-    if (*s == '\0' || *end != '\0')
-	rc = -1;
-
-    if ((val == LONG_MIN || val == LONG_MAX) && errno == ERANGE)
-	rc = -1;
-
-    if (rc == 0)
-	*ret = val;
-
-    return rc;
-}
-
-static int lookup_num(const char *path, const char *val, int vcol, int rcol,
-			long *ret)
+static int lookup_name(const char *path, long id, string *ret)
 {
-    char *buf = NULL;
-    int rc = lookup_field(path, val, vcol, rcol, &buf);
-    if (rc == 0) {
-	rc = stol(buf, ret);
-	free(buf);
+    ARGV_t paths = argvSplitString(path, ":", ARGV_SKIPEMPTY);
+    int rc = -1;
+    for (ARGV_t p = paths; *p; p++) {
+	const struct ugfile_s *uf = ugfileGet(*p);
+	if (uf == NULL)
+	    continue;
+	auto it = uf->names.find(id);
+	if (it != uf->names.end()) {
+	    *ret = it->second;
+	    rc = 0;
+	    break;
+	}
     }
-    return rc;
-}
-
-static int lookup_str(const char *path, long val, int vcol, int rcol,
-			char **ret)
-{
-    char *vbuf = NULL;
-    rasprintf(&vbuf, "%ld", val);
-    int rc = lookup_field(path, vbuf, vcol, rcol, ret);
-    free(vbuf);
+    argvFree(paths);
     return rc;
 }
 
@@ -185,7 +228,7 @@ int rpmugUid(const char * thisUname, uid_t * uid)
 	const char *path = pwfile();
 	long id;
 	if (path) {
-	    if (lookup_num(path, thisUname, 0, 2, &id))
+	    if (lookup_id(path, thisUname, &id))
 		return -1;
 	} else {
 	    struct passwd *pwent = getpwnam(thisUname);
@@ -216,7 +259,7 @@ int rpmugGid(const char * thisGname, gid_t * gid)
 	const char *path = grpfile();
 	long id;
 	if (path) {
-	    if (lookup_num(path, thisGname, 0, 2, &id))
+	    if (lookup_id(path, thisGname, &id))
 		return -1;
 	} else {
 	    struct group *grent = getgrnam(thisGname);
@@ -244,10 +287,10 @@ const char * rpmugUname(uid_t uid)
     auto it = rpmug->uidMap.find(uid);
     if (it == rpmug->uidMap.end()) {
 	const char *path = pwfile();
-	char *uname = NULL;
+	string uname;
 
 	if (path) {
-	    if (lookup_str(path, uid, 2, 0, &uname))
+	    if (lookup_name(path, uid, &uname))
 		return NULL;
 	} else {
 	    struct passwd *pwent = getpwuid(uid);
@@ -275,10 +318,10 @@ const char * rpmugGname(gid_t gid)
     auto it = rpmug->gidMap.find(gid);
     if (it == rpmug->gidMap.end()) {
 	const char *path = grpfile();
-	char *gname = NULL;
+	string gname;
 
 	if (path) {
-	    if (lookup_str(path, gid, 2, 0, &gname))
+	    if (lookup_name(path, gid, &gname))
 		return NULL;
 	} else {
 	    struct group *grent = getgrgid(gid);
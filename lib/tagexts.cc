@@ -1147,6 +1147,45 @@ static const struct headerTagFunc_s rpmHeaderTagExtensions[] = {
     { 0, 			NULL }
 };
 
+/*
+ * Header tags consulted by extensions, for partial header imports.
+ * Extensions not listed here may need anything in the header.
+ */
+static const struct headerTagDeps_s {
+    rpmTagVal tag;
+    rpmTagVal deps[8];
+} rpmHeaderTagExtDeps[] = {
+    { RPMTAG_GROUP,	{ RPMTAG_NAME, RPMTAG_GROUP, RPMTAG_HEADERI18NTABLE } },
+    { RPMTAG_DESCRIPTION, { RPMTAG_NAME, RPMTAG_DESCRIPTION,
+			  RPMTAG_HEADERI18NTABLE } },
+    { RPMTAG_SUMMARY,	{ RPMTAG_NAME, RPMTAG_SUMMARY, RPMTAG_HEADERI18NTABLE } },
+    { RPMTAG_LONGARCHIVESIZE, { RPMTAG_LONGARCHIVESIZE, RPMTAG_ARCHIVESIZE } },
+    { RPMTAG_LONGSIZE,	{ RPMTAG_LONGSIZE, RPMTAG_SIZE } },
+    { RPMTAG_DBINSTANCE,	{ } },
+    { RPMTAG_EVR,	{ RPMTAG_EPOCH, RPMTAG_VERSION, RPMTAG_RELEASE } },
+    { RPMTAG_NVR,	{ RPMTAG_NAME, RPMTAG_VERSION, RPMTAG_RELEASE } },
+    { RPMTAG_NEVR,	{ RPMTAG_NAME, RPMTAG_EPOCH, RPMTAG_VERSION,
+			  RPMTAG_RELEASE } },
+    { RPMTAG_NVRA,	{ RPMTAG_NAME, RPMTAG_VERSION, RPMTAG_RELEASE,
+			  RPMTAG_ARCH, RPMTAG_SOURCEPACKAGE, RPMTAG_SOURCERPM } },
+    { RPMTAG_NEVRA,	{ RPMTAG_NAME, RPMTAG_EPOCH, RPMTAG_VERSION,
+			  RPMTAG_RELEASE, RPMTAG_ARCH, RPMTAG_SOURCEPACKAGE,
+			  RPMTAG_SOURCERPM } },
+    { RPMTAG_EPOCHNUM,	{ RPMTAG_EPOCH } },
+    { 0,		{ } }
+};
+
+const rpmTagVal * rpmHeaderTagDeps(rpmTagVal tag)
+{
+    const struct headerTagDeps_s * ext;
+
+    for (ext = rpmHeaderTagExtDeps; ext->tag != 0; ext++) {
+	if (ext->tag == tag)
+	    return ext->deps;
+    }
+    return NULL;
+}
+
 headerTagTagFunction rpmHeaderTagFunc(rpmTagVal tag)
 {
     const struct headerTagFunc_s * ext;
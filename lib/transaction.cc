@@ -4,6 +4,10 @@
 
 #include "system.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <set>
 #include <vector>
 
@@ -12,6 +16,9 @@
 #include <errno.h>
 #include <sys/statvfs.h>
 #include <fcntl.h>
+#ifdef ENABLE_OPENMP
+#include <omp.h>
+#endif
 
 /* duplicated from cpio.c */
 #if defined(MAJOR_IN_MKDEV)
@@ -35,6 +42,7 @@
 #include "fprint.hh"
 #include "misc.hh"
 #include "rpmchroot.hh"
+#include "rpmdb_internal.hh"
 #include "rpmlock.hh"
 #include "rpmds_internal.hh"
 #include "rpmfi_internal.hh"	/* only internal apis */
@@ -382,6 +390,12 @@ static int handleColorConflict(rpmts ts,
     return rConflicts;
 }
 
+/* Is the transaction element a reinstall of the element being removed? */
+static int isReinstall(rpmte p, rpmte other)
+{
+    return (other != NULL && rstreq(rpmteNEVRA(p), rpmteNEVRA(other)));
+}
+
 /**
  * handleInstInstalledFiles.
  * @param ts		transaction set
@@ -392,11 +406,12 @@ static int handleColorConflict(rpmts ts,
  * @param otherFi	matching file info set
  * @param ofx		matching file index
  * @param beingRemoved  file being removed (installed otherwise)
+ * @param reinstall	is p a reinstall of the package being removed?
  */
 /* XXX only ts->{probs,rpmdb} modified */
 static void handleInstInstalledFile(const rpmts ts, rpmte p, rpmfiles fi, int fx,
 				   Header otherHeader, rpmfiles otherFi, int ofx,
-				   int beingRemoved)
+				   int beingRemoved, int reinstall)
 {
     rpmfs fs = rpmteGetFileStates(p);
     int isCfgFile = ((rpmfilesFFlags(otherFi, ofx) | rpmfilesFFlags(fi, fx)) & RPMFILE_CONFIG);
@@ -479,12 +494,16 @@ static void handleInstInstalledFile(const rpmts ts, rpmte p, rpmfiles fi, int fx
     rpmfilesSetFReplacedSize(fi, fx, otherFileSize + 1);
 
     /* Just touch already existing files if minimize_writes is enabled */
-    if (ts->min_writes) {
+    if (ts->min_writes != MINWRITES_OFF) {
 	if ((!isCfgFile) && (rpmfsGetAction(fs, fx) == FA_UNKNOWN)) {
 	    /* XXX fsm can't handle FA_TOUCH of hardlinked files */
 	    int nolinks = (nlink == 1 && rpmfilesFNlink(fi, fx) == 1);
-	    if (nolinks && rpmfileContentsEqual(otherFi, ofx, fi, fx))
+	    if (nolinks && (ts->min_writes == MINWRITES_ON ||
+			    reinstall) &&
+		rpmfileContentsEqual(otherFi, ofx, fi, fx))
+	    {
 	       rpmfsSetAction(fs, fx, FA_TOUCH);
+	    }
 	}
     }
 }
@@ -1068,13 +1087,17 @@ void checkInstalledFiles(rpmts ts, uint64_t fileCount, fingerPrintCache fpc)
 	unsigned int installedPkg;
 	int beingRemoved = 0;
 	rpmfiles otherFi = NULL;
+	rpmte otherTe = NULL;
+	rpmte reinstallTe = NULL;
+	int reinstall = 0;
 
 	/* Is this package being removed? */
 	installedPkg = rpmdbGetIteratorOffset(mi);
 	auto it = tsmem->removedPackages.find(installedPkg);
 	if (it != tsmem->removedPackages.end()) {
 	    beingRemoved = 1;
-	    otherFi = rpmteFiles(it->second);
+	    otherTe = it->second;
+	    otherFi = rpmteFiles(otherTe);
 	}
 
 	h = headerLink(h);
@@ -1126,8 +1149,14 @@ void checkInstalledFiles(rpmts ts, uint64_t fileCount, fingerPrintCache fpc)
 			/* XXX What to do if this fails? */
 		        otherFi = rpmfilesNew(NULL, h, RPMTAG_BASENAMES, RPMFI_KEEPHEADER);
 		    }
+		    /* Only look again when the element changes */
+		    if (p != reinstallTe) {
+			reinstallTe = p;
+			reinstall = isReinstall(p, otherTe);
+		    }
 		    handleInstInstalledFile(ts, p, fi, recs[j].fileno,
-					    h, otherFi, fileNum, beingRemoved);
+					    h, otherFi, fileNum, beingRemoved,
+					    reinstall);
 		    break;
 		case TR_REMOVED:
 		    if (!beingRemoved) {
@@ -1266,47 +1295,152 @@ static void finiPkgDigests(FD_t fd, ARGI_t ids, Header auxh)
     argiFree(ids);
 }
 
-static int verifyPackage(rpmts ts, rpmte p, struct rpmvs_s *vs, int vfylevel)
+namespace {
+struct vfyjob_s {
+    rpmte p;			/* element being verified */
+    FD_t fd;			/* package file, owned by the job */
+    ARGI_t ids;			/* package digest ids */
+    struct rpmvs_s *vs;		/* verify set */
+    struct vfydata_s vd;	/* verify results */
+    int readrc;			/* package read result */
+    int prc;			/* verify result */
+    std::atomic_bool done;	/* read and verify completed */
+};
+
+struct vfyjobs_s {
+    int nthreads;		/* number of reader threads */
+    std::deque<struct vfyjob_s *> queue;
+    std::mutex mutex;		/* for waiting on reader threads */
+    std::condition_variable cond;
+};
+}
+
+static void vfyJobRun(struct vfyjob_s *job);
+
+/* Finish the package digests, in the callback thread */
+static void vfyJobDigests(rpmts ts, struct vfyjob_s *job)
 {
-    struct vfydata_s vd = {
-	.msg = NULL,
-	.type = { -1, -1, -1, },
-	.vfylevel = vfylevel,
-    };
-    int verified = 0;
-    int prc = RPMRC_FAIL;
-    Header auxh = rpmteHeaderAux(p, 1);
+    Header auxh = rpmteHeaderAux(job->p, 1);
+    int test = rpmtsFlags(ts) & RPMTRANS_FLAG_TEST;
+    finiPkgDigests(job->fd, job->ids, (test || job->readrc) ? NULL : auxh);
+    job->ids = NULL;
+    headerFree(auxh);
+}
+
+/* Open the package and set up verification, in the callback thread */
+static struct vfyjob_s *vfyJobOpen(rpmts ts, rpmte p, rpmKeyring keyring,
+				   rpmVSFlags vsflags)
+{
+    struct vfyjob_s *job = new vfyjob_s {};
+    int vfylevel = rpmteVfyLevel(p);
+    FD_t fd;
+
+    job->p = p;
+    job->vs = rpmvsCreate(vfylevel, vsflags, keyring);
+    job->vd.msg = NULL;
+    job->vd.type[0] = job->vd.type[1] = job->vd.type[2] = -1;
+    job->vd.vfylevel = vfylevel;
+    job->readrc = RPMRC_FAIL;
+    job->prc = RPMRC_FAIL;
+
+    fd = (FD_t)rpmtsNotify(ts, p, RPMCALLBACK_INST_OPEN_FILE, 0, 0);
+    if (fd == NULL)
+	return job;
+
+    /*
+     * The callbacks only track one open package at a time. Have the worker
+     * read from a descriptor of its own so the package can be closed right
+     * away. Without a descriptor to share, verify it here and now.
+     */
+    if (Fileno(fd) >= 0)
+	job->fd = fdDup(Fileno(fd));
+    if (job->fd == NULL) {
+	job->fd = fd;
+	job->ids = initPkgDigests(job->fd);
+	vfyJobRun(job);
+	vfyJobDigests(ts, job);
+	job->fd = NULL;
+    } else {
+	job->ids = initPkgDigests(job->fd);
+    }
+    rpmtsNotify(ts, p, RPMCALLBACK_INST_CLOSE_FILE, 0, 0);
+
+    return job;
+}
+
+/* Read and verify the package, safe to run in worker threads */
+static void vfyJobRun(struct vfyjob_s *job)
+{
+    ssize_t nb = 0;
 
-    FD_t fd = (FD_t)rpmtsNotify(ts, p, RPMCALLBACK_INST_OPEN_FILE, 0, 0);
-    if (fd != NULL) {
-	ARGI_t ids = initPkgDigests(fd);
-	prc = rpmpkgRead(vs, fd, NULL, NULL, &vd.msg);
-	int test = rpmtsFlags(ts) & RPMTRANS_FLAG_TEST;
-	finiPkgDigests(fd, ids, (test || prc) ? NULL : auxh);
-	rpmtsNotify(ts, p, RPMCALLBACK_INST_CLOSE_FILE, 0, 0);
+    (void) rpmswEnter(rpmteOp(job->p, RPMTS_OP_VERIFY), 0);
+    if (job->fd != NULL) {
+	job->readrc = rpmpkgRead(job->vs, job->fd, NULL, NULL, &job->vd.msg);
+	job->prc = job->readrc;
+	nb = Ftell(job->fd);
     }
 
-    if (prc == RPMRC_OK)
-	prc = rpmvsVerify(vs, RPMSIG_VERIFIABLE_TYPE, vfyCb, &vd);
+    if (job->prc == RPMRC_OK)
+	job->prc = rpmvsVerify(job->vs, RPMSIG_VERIFIABLE_TYPE, vfyCb, &job->vd);
+    (void) rpmswExit(rpmteOp(job->p, RPMTS_OP_VERIFY), nb);
+
+    job->done = true;
+}
+
+/* Close the job's package file and record the results, in the callback thread */
+static int vfyJobFinish(rpmts ts, struct vfyjob_s *job)
+{
+    rpmte p = job->p;
+    struct vfydata_s *vd = &job->vd;
+    int prc = job->prc;
+    int verified = 0;
+
+    if (job->fd != NULL) {
+	vfyJobDigests(ts, job);
+	Fclose(job->fd);
+    }
 
     /* Record verify result */
-    if (vd.type[RPMSIG_SIGNATURE_TYPE] == RPMRC_OK)
+    if (vd->type[RPMSIG_SIGNATURE_TYPE] == RPMRC_OK)
 	verified |= RPMSIG_SIGNATURE_TYPE;
-    if (vd.type[RPMSIG_DIGEST_TYPE] == RPMRC_OK)
+    if (vd->type[RPMSIG_DIGEST_TYPE] == RPMRC_OK)
 	verified |= RPMSIG_DIGEST_TYPE;
     rpmteSetVerified(p, verified);
 
     if (prc) {
-	if (vd.msg == NULL)
-	    vd.msg = xstrdup(_("no verifiable digest or signature available"));
-	rpmteAddProblem(p, RPMPROB_VERIFY, NULL, vd.msg, 0);
+	if (vd->msg == NULL)
+	    vd->msg = xstrdup(_("no verifiable digest or signature available"));
+	rpmteAddProblem(p, RPMPROB_VERIFY, NULL, vd->msg, 0);
     }
 
-    vd.msg = _free(vd.msg);
-    headerFree(auxh);
+    vd->msg = _free(vd->msg);
+    rpmvsFree(job->vs);
+    delete job;
     return prc;
 }
 
+/*
+ * Reap verified packages in transaction order. With wait set, all jobs
+ * are finished, otherwise only as many as needed to get below maxjobs.
+ */
+static void vfyJobsReap(rpmts ts, struct vfyjobs_s *jobs,
+			size_t maxjobs, int wait)
+{
+    while (!jobs->queue.empty()) {
+	struct vfyjob_s *job = jobs->queue.front();
+	if (!job->done) {
+	    if (!(wait || jobs->queue.size() >= maxjobs))
+		break;
+	    /* Sleep until the reader of the oldest job is done */
+	    std::unique_lock<std::mutex> lock(jobs->mutex);
+	    jobs->cond.wait(lock, [job] { return job->done.load(); });
+	    continue;
+	}
+	jobs->queue.pop_front();
+	vfyJobFinish(ts, job);
+    }
+}
+
 static int verifyPackageFiles(rpmts ts, rpm_loff_t total)
 {
     int rc = 0;
@@ -1315,18 +1449,58 @@ static int verifyPackageFiles(rpmts ts, rpm_loff_t total)
     rpmte p;
     rpm_loff_t oc = 0;
     rpmVSFlags vsflags = rpmtsVfyFlags(ts);
+    int nthreads = rpmExpandNumeric("%{?_pkgverify_nthreads}");
+    struct vfyjobs_s jobs;
+
+    if (nthreads < 0)
+	nthreads = rpmExpandNumeric("%{getncpus:thread}");
+#ifndef ENABLE_OPENMP
+    nthreads = 1;
+#endif
+    if (nthreads < 1)
+	nthreads = 1;
 
     rpmtsNotify(ts, NULL, RPMCALLBACK_VERIFY_START, 0, total);
 
     (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_VERIFY), 0);
 
+    /*
+     * Packages are opened and closed one at a time, and the results
+     * recorded, in transaction order in this thread as the callbacks
+     * expect. The reading and digesting of the package files happens in
+     * worker threads on descriptors of their own, with at most two
+     * packages per thread in flight.
+     */
     pi = rpmtsiInit(ts);
+    jobs.nthreads = nthreads;
+    #pragma omp parallel num_threads(nthreads) if (nthreads > 1)
+    #pragma omp master
+    {
+#ifdef ENABLE_OPENMP
+    /* The team can be smaller than asked for, don't wait on idle tasks */
+    jobs.nthreads = omp_get_num_threads();
+#endif
     while ((p = rpmtsiNext(pi, TR_ADDED))) {
-	int vfylevel = rpmteVfyLevel(p);
-	struct rpmvs_s *vs = rpmvsCreate(vfylevel, vsflags, keyring);
+	struct vfyjob_s *job;
+	struct vfyjobs_s *jobsp = &jobs;
+
 	rpmtsNotify(ts, p, RPMCALLBACK_VERIFY_PROGRESS, oc++, total);
-	verifyPackage(ts, p, vs, vfylevel);
-	rpmvsFree(vs);
+	job = vfyJobOpen(ts, p, keyring, vsflags);
+	jobs.queue.push_back(job);
+
+	if (!job->done) {
+	    #pragma omp task firstprivate(jobsp, job) if (jobsp->nthreads > 1)
+	    {
+	    vfyJobRun(job);
+	    /* Wake up the reaper, see vfyJobsReap() */
+	    std::lock_guard<std::mutex> lock(jobsp->mutex);
+	    jobsp->cond.notify_one();
+	    } /* omp task */
+	}
+
+	vfyJobsReap(ts, &jobs, jobs.nthreads * 2, 0);
+    }
+    vfyJobsReap(ts, &jobs, 0, 1);
     }
     rpmtsNotify(ts, NULL, RPMCALLBACK_VERIFY_STOP, total, total);
 
@@ -1649,7 +1823,9 @@ static int rpmtsProcess(rpmts ts)
 	rpmlog(RPMLOG_DEBUG, "========== +++ %s %s-%s 0x%x\n",
 		rpmteNEVR(p), rpmteA(p), rpmteO(p), rpmteColor(p));
 
+	(void) rpmswEnter(rpmteOp(p, RPMTS_OP_TOTAL), 0);
 	failed = rpmteProcess(p, (pkgGoal)rpmteType(p), i++);
+	(void) rpmswExit(rpmteOp(p, RPMTS_OP_TOTAL), 0);
 	if (failed) {
 	    rpmlog(RPMLOG_ERR, "%s: %s %s\n", rpmteNEVRA(p),
 		   rpmteTypeString(p), failed > 1 ? _("skipped") : _("failed"));
@@ -1729,9 +1905,11 @@ rpmRC runScript(rpmts ts, rpmte te, Header h, ARGV_const_t prefixes,
 	sfd = rpmtsScriptFd(ts);
 
     rpmswEnter(rpmtsOp(ts, RPMTS_OP_SCRIPTLETS), 0);
+    rpmswEnter(rpmteOp(te, RPMTS_OP_SCRIPTLETS), 0);
     rc = rpmScriptRun(script, arg1, arg2, sfd,
 		      prefixes, rpmtsPlugins(ts));
     rpmswExit(rpmtsOp(ts, RPMTS_OP_SCRIPTLETS), 0);
+    rpmswExit(rpmteOp(te, RPMTS_OP_SCRIPTLETS), 0);
 
     /* Map warn-only errors to "notfound" for script stop callback */
     stoprc = (rc != RPMRC_OK && warn_only) ? RPMRC_NOTFOUND : rc;
@@ -1872,8 +2050,13 @@ int rpmtsRun(rpmts ts, rpmps okProbs, rpmprobFilterFlags ignoreSet)
 	runTransScripts(ts, PKG_TRANSFILETRIGGERUN);
     }
 
-    /* Actually install and remove packages */
+    /* Actually install and remove packages, batching database commits */
+    if (!(rpmtsFlags(ts) & RPMTRANS_FLAG_TEST))
+	rpmdbBatchBegin(rpmtsGetRdb(ts),
+			rpmExpandNumeric("%{?_db_batch_size}"));
     nfailed = rpmtsProcess(ts);
+    if (rpmdbBatchEnd(rpmtsGetRdb(ts)))
+	nfailed++;
 
     /* Run %posttrans scripts unless disabled */
     if (!(rpmtsFlags(ts) & (RPMTRANS_FLAG_NOPOSTTRANS))) {
@@ -1924,6 +2107,10 @@ exit:
     if (!(rpmtsFlags(ts) & RPMTRANS_FLAG_TEST) && nfailed >= 0) {
 	rpmtsSync(ts);
     }
+
+    /* Timings and counters are final now */
+    if (TsmPreDone)
+	rpmtsReportStats(ts, rc);
     (void) umask(oldmask);
     (void) rpmtsFinish(ts);
     rpmpsFree(tsprobs);
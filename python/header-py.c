@@ -710,6 +710,116 @@ PyObject * hdr_Wrap(PyTypeObject *subtype, Header h)
     return (PyObject *) hdr;
 }
 
+struct hdrfmtObject_s {
+    PyObject_HEAD
+    headerFormatter hf;
+};
+
+static PyObject *hdrfmt_new(PyTypeObject *subtype,
+			    PyObject *args, PyObject *kwds)
+{
+    const char *fmt;
+    errmsg_t err = NULL;
+    headerFormatter hf;
+    hdrfmtObject *s;
+    char *kwlist[] = {"format", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &fmt))
+	return NULL;
+
+    hf = headerFormatterNew(fmt, &err);
+    if (hf == NULL) {
+	rpmmodule_state_t *modstate = rpmModState_FromType(subtype);
+	if (modstate)
+	    PyErr_SetString(modstate->pyrpmError, err);
+	return NULL;
+    }
+
+    allocfunc subtype_alloc = (allocfunc)PyType_GetSlot(subtype, Py_tp_alloc);
+    s = (hdrfmtObject *)subtype_alloc(subtype, 0);
+    if (s == NULL) {
+	headerFormatterFree(hf);
+	return NULL;
+    }
+    s->hf = hf;
+    return (PyObject *) s;
+}
+
+static void hdrfmt_dealloc(hdrfmtObject * s)
+{
+    PyObject_GC_UnTrack(s);
+    s->hf = headerFormatterFree(s->hf);
+    PyTypeObject *type = Py_TYPE(s);
+    freefunc free = PyType_GetSlot(type, Py_tp_free);
+    free(s);
+    Py_DECREF(type);
+}
+
+static int hdrfmt_traverse(hdrfmtObject * s, visitproc visit, void *arg)
+{
+    if (python_version >= 0x03090000) {
+        Py_VISIT(Py_TYPE(s));
+    }
+    return 0;
+}
+
+static PyObject * hdrfmt_format(hdrfmtObject * s, PyObject * args,
+				PyObject * kwds)
+{
+    Header h = NULL;
+    const char *r;
+    errmsg_t err = NULL;
+    char * kwlist[] = {"header", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", kwlist,
+				     hdrFromPyObject, &h))
+	return NULL;
+
+    r = headerFormatterRender(s->hf, h, &err);
+    if (!r) {
+	rpmmodule_state_t *modstate = rpmModState_FromObject((PyObject*)s);
+	if (modstate) {
+	    PyErr_SetString(modstate->pyrpmError, err);
+	}
+	return NULL;
+    }
+
+    return utf8FromString(r);
+}
+
+static struct PyMethodDef hdrfmt_methods[] = {
+    {"format",		(PyCFunction) hdrfmt_format,	METH_VARARGS|METH_KEYWORDS,
+     "fmt.format(header) -- Expand the compiled rpm-queryformat(7) string\n"
+     "with the header data." },
+    {NULL,		NULL}		/* sentinel */
+};
+
+static char hdrfmt_doc[] =
+  "A compiled rpm-queryformat(7) string, for formatting many headers\n"
+  "without parsing the format again for each of them:\n"
+  "\n"
+  "	fmt = rpm.hdrfmt('%{nevra}\\n')\n"
+  "	for h in ts.dbMatch():\n"
+  "	    print(fmt.format(h), end='')\n";
+
+static PyType_Slot hdrfmt_Type_Slots[] = {
+    {Py_tp_dealloc, hdrfmt_dealloc},
+    {Py_tp_traverse, hdrfmt_traverse},
+    {Py_tp_call, hdrfmt_format},
+    {Py_tp_getattro, PyObject_GenericGetAttr},
+    {Py_tp_setattro, PyObject_GenericSetAttr},
+    {Py_tp_doc, hdrfmt_doc},
+    {Py_tp_methods, hdrfmt_methods},
+    {Py_tp_new, hdrfmt_new},
+    {0, NULL},
+};
+PyType_Spec hdrfmt_Type_Spec = {
+    .name = "rpm.hdrfmt",
+    .basicsize = sizeof(hdrfmtObject),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_IMMUTABLETYPE,
+    .slots = hdrfmt_Type_Slots,
+};
+
 int hdrFromPyObject(PyObject *item, Header *hptr)
 {
     if (hdrObject_Check(item)) {
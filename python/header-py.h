@@ -6,6 +6,9 @@
 typedef struct hdrObject_s hdrObject;
 extern PyType_Spec hdr_Type_Spec;
 
+typedef struct hdrfmtObject_s hdrfmtObject;
+extern PyType_Spec hdrfmt_Type_Spec;
+
 static inline int hdrObject_Check(PyObject *v) {
 	rpmmodule_state_t *modstate = rpmModState_FromObject(v);
     if (!modstate) {
@@ -5,6 +5,7 @@ from rpm._rpm import ts as TransactionSetCore
 # TODO: migrate relevant documentation from C-side
 class TransactionSet(TransactionSetCore):
     _probFilter = 0
+    _runResult = None
 
     def _wrapSetGet(self, attr, val):
         oval = getattr(self, attr)
@@ -121,6 +122,7 @@ class TransactionSet(TransactionSetCore):
 
     def run(self, callback, data):
         rc = TransactionSetCore.run(self, callback, data, self._probFilter)
+        self._runResult = rc
 
         # crazy backwards compatibility goo: None for ok, list of problems
         # if transaction didn't complete and empty list if it completed
@@ -135,6 +137,37 @@ class TransactionSet(TransactionSetCore):
                 res.append(item)
         return res
 
+    def _ops(self, getop):
+        ops = {}
+        for name in dir(rpm):
+            if not name.startswith('RPMTS_OP_'):
+                continue
+            count, nbytes, usecs = getop(getattr(rpm, name))
+            if count > 0:
+                ops[name[9:].lower()] = {
+                    'count': count, 'bytes': nbytes, 'usecs': usecs
+                }
+        return ops
+
+    def stats(self):
+        """Return the timings and counters of the transaction and its
+        elements, in the same layout as %_transaction_stats_path.
+        The result is that of the last run(), None if not run yet."""
+        elements = []
+        for te in self:
+            elements.append({
+                'nevra': te.NEVRA(),
+                'type': 'install' if te.Type() == rpm.TR_ADDED else 'erase',
+                'failed': te.Failed(),
+                'ops': self._ops(te.Op),
+            })
+        return {
+            'tid': self.tid,
+            'result': self._runResult,
+            'transaction': {'ops': self._ops(self.op)},
+            'elements': elements,
+        }
+
     def check(self, *args, **kwds):
         TransactionSetCore.check(self, *args, **kwds)
 
@@ -231,6 +231,7 @@ static int initModule(PyObject *m);
 static int rpmModuleTraverse(PyObject *m, visitproc visit, void *arg) {
     rpmmodule_state_t *modstate = PyModule_GetState(m);
     Py_VISIT(modstate->hdr_Type);
+    Py_VISIT(modstate->hdrfmt_Type);
     Py_VISIT(modstate->rpmarchive_Type);
     Py_VISIT(modstate->rpmds_Type);
     Py_VISIT(modstate->rpmfd_Type);
@@ -254,6 +255,7 @@ static int rpmModuleTraverse(PyObject *m, visitproc visit, void *arg) {
 static int rpmModuleClear(PyObject *m) {
     rpmmodule_state_t *modstate = PyModule_GetState(m);
     Py_CLEAR(modstate->hdr_Type);
+    Py_CLEAR(modstate->hdrfmt_Type);
     Py_CLEAR(modstate->rpmarchive_Type);
     Py_CLEAR(modstate->rpmds_Type);
     Py_CLEAR(modstate->rpmfd_Type);
@@ -379,6 +381,10 @@ static int initModule(PyObject *m)
 	return -1;
     }
 
+    if (!initAndAddType(m, &modstate->hdrfmt_Type, &hdrfmt_Type_Spec, "hdrfmt")) {
+	return -1;
+    }
+
     if (!initAndAddType(m, &modstate->rpmarchive_Type, &rpmarchive_Type_Spec, "archive")) {
 	return -1;
     }
@@ -645,6 +651,26 @@ static int initModule(PyObject *m)
     REGISTER_ENUM(TR_REMOVED);
     REGISTER_ENUM(TR_RPMDB);
 
+    REGISTER_ENUM(RPMTS_OP_TOTAL);
+    REGISTER_ENUM(RPMTS_OP_CHECK);
+    REGISTER_ENUM(RPMTS_OP_ORDER);
+    REGISTER_ENUM(RPMTS_OP_FINGERPRINT);
+    REGISTER_ENUM(RPMTS_OP_INSTALL);
+    REGISTER_ENUM(RPMTS_OP_ERASE);
+    REGISTER_ENUM(RPMTS_OP_SCRIPTLETS);
+    REGISTER_ENUM(RPMTS_OP_COMPRESS);
+    REGISTER_ENUM(RPMTS_OP_UNCOMPRESS);
+    REGISTER_ENUM(RPMTS_OP_DIGEST);
+    REGISTER_ENUM(RPMTS_OP_SIGNATURE);
+    REGISTER_ENUM(RPMTS_OP_DBADD);
+    REGISTER_ENUM(RPMTS_OP_DBREMOVE);
+    REGISTER_ENUM(RPMTS_OP_DBGET);
+    REGISTER_ENUM(RPMTS_OP_DBPUT);
+    REGISTER_ENUM(RPMTS_OP_DBDEL);
+    REGISTER_ENUM(RPMTS_OP_VERIFY);
+    REGISTER_ENUM(RPMTS_OP_FSYNC);
+    REGISTER_ENUM(RPMTS_OP_FILES);
+
     REGISTER_ENUM(RPMDBI_PACKAGES);
     REGISTER_ENUM(RPMDBI_LABEL);
     REGISTER_ENUM(RPMDBI_INSTFILENAMES);
@@ -11,6 +11,7 @@
 
 typedef struct {
     PyTypeObject* hdr_Type;
+    PyTypeObject* hdrfmt_Type;
     PyTypeObject* rpmarchive_Type;
     PyTypeObject* rpmds_Type;
     PyTypeObject* rpmfd_Type;
@@ -247,6 +247,24 @@ rpmte_SetVfyLevel(rpmteObject *s, PyObject *arg)
     return Py_BuildValue("i", rpmteSetVfyLevel(s->te, vfylevel));
 }
 
+static PyObject *
+rpmte_Op(rpmteObject *s, PyObject *arg)
+{
+    int opx;
+    rpmop op;
+
+    if (!PyArg_Parse(arg, "i", &opx))
+	return NULL;
+
+    if ((op = rpmteOp(s->te, (rpmtsOpX)opx)) == NULL) {
+	PyErr_SetString(PyExc_ValueError, "invalid operation");
+	return NULL;
+    }
+
+    return Py_BuildValue("(iKk)", op->count,
+			 (unsigned long long)op->bytes, op->usecs);
+}
+
 static struct PyMethodDef rpmte_methods[] = {
     {"Type",	(PyCFunction)rpmte_TEType,	METH_NOARGS,
      "te.Type() -- Return element type (rpm.TR_ADDED | rpm.TR_REMOVED).\n" },
@@ -298,6 +316,9 @@ static struct PyMethodDef rpmte_methods[] = {
      "Return per-element verification level.\n" },
     {"SetVfyLevel",(PyCFunction)rpmte_SetVfyLevel, METH_O,
      "Set per-element verification level.\n" },
+    {"Op",	(PyCFunction)rpmte_Op,		METH_O,
+"te.Op(opx) -- Return (count, bytes, usecs) statistics of an operation\n\
+on the element, opx is one of RPMTS_OP_*.\n" },
     {NULL,		NULL}		/* sentinel */
 };
 
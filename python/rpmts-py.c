@@ -401,6 +401,24 @@ rpmts_dbCookie(rpmtsObject * s)
     return ret;
 }
 
+static PyObject *
+rpmts_Op(rpmtsObject * s, PyObject * args)
+{
+    int opx;
+    rpmop op;
+
+    if (!PyArg_ParseTuple(args, "i:op", &opx))
+	return NULL;
+
+    if ((op = rpmtsOp(s->ts, (rpmtsOpX)opx)) == NULL) {
+	PyErr_SetString(PyExc_ValueError, "invalid operation");
+	return NULL;
+    }
+
+    return Py_BuildValue("(iKk)", op->count,
+			 (unsigned long long)op->bytes, op->usecs);
+}
+
 static PyObject *
 rpmts_HdrFromFdno(rpmtsObject * s, PyObject *arg)
 {
@@ -868,6 +886,9 @@ Remove all elements from the transaction set\n" },
  {"dbCookie",	(PyCFunction) rpmts_dbCookie, 	METH_NOARGS,
 "dbCookie -> cookie\n\
 - Return a cookie string for determining if database has changed\n" },
+ {"op",	(PyCFunction) rpmts_Op,	METH_VARARGS,
+"ts.op(opx) -> (count, bytes, usecs)\n\
+- Return statistics of a transaction operation, opx is one of RPMTS_OP_*\n" },
     {NULL,		NULL}		/* sentinel */
 };
 
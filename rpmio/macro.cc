@@ -6,9 +6,10 @@
 
 #include <algorithm>
 #include <cinttypes>
-#include <map>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <unordered_map>
 #include <vector>
 #include <stack>
@@ -16,6 +17,8 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <libgen.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #ifdef HAVE_SCHED_GETAFFINITY
 #include <sched.h>
 #endif
@@ -66,7 +69,26 @@ struct rpmMacroEntry_s {
     string sopts;
 };
 
-using macroTable = std::map<string,std::stack<rpmMacroEntry_s>>;
+/* Hash macro names as string views, for lookups without a temporary string */
+struct macroHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view n) const noexcept {
+	return std::hash<std::string_view>{}(n);
+    }
+};
+
+using macroTable = std::unordered_map<string,std::stack<rpmMacroEntry_s>,
+				      macroHash,std::equal_to<>>;
+
+/*! A macro definition loaded from a macro file, for the macro cache */
+struct macroDef {
+    string name;
+    string opts;
+    string body;
+    bool hasopts;
+    int flags;
+};
+
 using wrlock = std::lock_guard<std::recursive_mutex>;
 
 /*! The structure used to store the set of macros in a context. */
@@ -78,6 +100,9 @@ using wrlock = std::lock_guard<std::recursive_mutex>;
  */
 struct rpmMacroContext_s {
     macroTable tab {};	/*!< Map of macro entry stacks */
+    /*! Names and levels of scoped macros, in order of definition */
+    std::vector<std::pair<string,int>> scoped {};
+    std::vector<macroDef> *defs {}; /*!< Record definitions (macro cache) */
     int depth {};	 /*!< Depth tracking on external recursion */
     int level {};	 /*!< Scope level tracking when on external recursion */
     std::recursive_mutex mutex {};
@@ -132,11 +157,12 @@ static void pushMacro(rpmMacroContext mc,
 	const std::string & n, const char * o, const std::string & b,
 	int level, int flags);
 static void popMacro(rpmMacroContext mc, const std::string & n);
-static int loadMacroFile(rpmMacroContext mc, const std::string fn);
+static int loadMacroFile(rpmMacroContext mc, const std::string fn,
+			 std::vector<macroDef> *defs = NULL);
 /* =============================================================== */
 
 static rpmMacroEntry
-findEntry(rpmMacroContext mc, const string & n, size_t *pos)
+findEntry(rpmMacroContext mc, std::string_view n, size_t *pos)
 {
     auto const & entry = mc->tab.find(n);
     if (entry == mc->tab.end())
@@ -157,8 +183,7 @@ findEntry(rpmMacroContext mc, const char *name, size_t namelen, size_t *pos)
 {
     if (namelen == 0)
 	namelen = strlen(name);
-    string n(name, namelen);
-    return findEntry(mc, n, pos);
+    return findEntry(mc, std::string_view(name, namelen), pos);
 }
 
 /* =============================================================== */
@@ -905,15 +930,16 @@ freeArgs(rpmMacroBuf mb)
 {
     rpmMacroContext mc = mb->mc;
 
-    /* Delete dynamic macro definitions */
-    auto it = mc->tab.begin();
-    while (it != mc->tab.end()) {
+    /* Delete dynamic macro definitions, the innermost scope is on top */
+    while (!mc->scoped.empty() && mc->scoped.back().second >= mb->level) {
+	auto it = mc->tab.find(mc->scoped.back().first);
+	mc->scoped.pop_back();
+	/* Already undefined or popped as a duplicate */
+	if (it == mc->tab.end() || it->second.top().level < mb->level)
+	    continue;
+
 	auto & stack = it->second;
 	auto & me = stack.top();
-	if (me.level < mb->level) {
-	    ++it;
-	    continue;
-	}
 	/* Warn on defined but unused non-automatic, scoped macros */
 	if (!(me.flags & (ME_AUTO|ME_USED))) {
 	    rpmMacroBufErr(mb, 0, _("Macro %%%s defined but not used within scope\n"),
@@ -927,9 +953,7 @@ freeArgs(rpmMacroBuf mb)
 	} while (stack.empty() == false && stack.top().level >= mb->level);
 
 	if (stack.empty())
-	    it = mc->tab.erase(it);
-	else
-	    ++it;
+	    mc->tab.erase(it);
     }
     mb->level--;
     mb->args = NULL;
@@ -1812,10 +1836,17 @@ static void pushMacroAny(rpmMacroContext mc,
 	const string & n, const char * o, const string & b,
 	macroFunc f, void *priv, int nargs, int level, int flags)
 {
-    auto res = mc->tab.insert({n, {}});
+    auto res = mc->tab.try_emplace(n);
     auto & entry = res.first;
     auto & stack = entry->second;
 
+    /* Scoped macros need to be found for deletion at the end of scope */
+    if (level > RMIL_GLOBAL)
+	mc->scoped.push_back({n, level});
+
+    if (mc->defs && f == NULL)
+	mc->defs->push_back({n, o ? o : "", b, (o != NULL), flags});
+
     /* push an empty entry to the stack and fillup */
     stack.push({});
     auto & me = stack.top();
@@ -1883,7 +1914,8 @@ static void linenoMacro(rpmMacroBuf mb,
     }
 }
 
-static int loadMacroFile(rpmMacroContext mc, const std::string fn)
+static int loadMacroFile(rpmMacroContext mc, const std::string fn,
+			 std::vector<macroDef> *defs)
 {
     FILE *fd = fopen(fn.c_str(), "r");
     size_t blen = MACROBUFSIZ;
@@ -1912,8 +1944,10 @@ static int loadMacroFile(rpmMacroContext mc, const std::string fn)
 		continue;
 	n++;	/* skip % */
 
+	mc->defs = defs;
 	if (defineMacro(mc, n, RMIL_MACROFILES))
 	    nfailed++;
+	mc->defs = NULL;
     }
     fclose(fd);
     popMacro(mc, "__file_name");
@@ -1925,6 +1959,209 @@ exit:
     return rc;
 }
 
+/*
+ * Macro cache: a snapshot of the definitions loaded from the macro files,
+ * validated by a key made of the rpm version and the path, size and
+ * modification time of each file. The format is native endian:
+ *   magic, key length, key, number of definitions, definitions
+ * where each definition consists of the flags, the name, the options
+ * (length ~0 for none) and the body, strings preceded by their length.
+ */
+#define MACROCACHE_MAGIC "RPMMACROCACHE\1\0\0"
+
+static string macroCacheKey(const string & macrofiles,
+			    const std::vector<string> & paths)
+{
+    string key = VERSION;
+    key += '\0';
+    key += macrofiles;
+    key += '\0';
+    for (auto const & path : paths) {
+	struct stat sb;
+	char buf[128];
+	if (stat(path.c_str(), &sb))
+	    return "";
+	snprintf(buf, sizeof(buf), "%jd:%jd.%09ld:%ju:%ju",
+		 (intmax_t)sb.st_size, (intmax_t)sb.st_mtim.tv_sec,
+		 sb.st_mtim.tv_nsec, (uintmax_t)sb.st_dev,
+		 (uintmax_t)sb.st_ino);
+	key += path;
+	key += '\0';
+	key += buf;
+	key += '\0';
+    }
+    return key;
+}
+
+/* Bounds checked reader of the cache file contents */
+struct cacheReader {
+    const char *p;
+    const char *end;
+
+    bool get(uint32_t *val) {
+	if (end - p < (ptrdiff_t)sizeof(*val))
+	    return false;
+	memcpy(val, p, sizeof(*val));
+	p += sizeof(*val);
+	return true;
+    }
+    bool get(std::string_view *sv) {
+	uint32_t len;
+	if (!get(&len) || (uint32_t)(end - p) < len)
+	    return false;
+	*sv = std::string_view(p, len);
+	p += len;
+	return true;
+    }
+};
+
+/*
+ * The cache gets to define arbitrary macros, so nobody else must be able
+ * to modify or replace it: the file has to be ours and only writable by
+ * us, and the directory only writable by us or root, or sticky.
+ */
+static int trustedCache(const char *fn, const struct stat *sb)
+{
+    struct stat dsb;
+    char *dn = xstrdup(fn);
+    int trusted = 0;
+
+    if (sb->st_uid != geteuid() || !S_ISREG(sb->st_mode) ||
+	    (sb->st_mode & (S_IWGRP|S_IWOTH)))
+	goto exit;
+
+    if (stat(dirname(dn), &dsb) || !S_ISDIR(dsb.st_mode))
+	goto exit;
+    if (dsb.st_uid != geteuid() && dsb.st_uid != 0)
+	goto exit;
+    if ((dsb.st_mode & (S_IWGRP|S_IWOTH)) && !(dsb.st_mode & S_ISVTX))
+	goto exit;
+    trusted = 1;
+
+exit:
+    free(dn);
+    return trusted;
+}
+
+static int loadMacroCache(rpmMacroContext mc, const char *fn, const string & key)
+{
+    struct stat sb;
+    void *map = MAP_FAILED;
+    int fd = open(fn, O_RDONLY|O_CLOEXEC|O_NOFOLLOW);
+    int rc = -1;
+
+    /* Only trust our own cache */
+    if (fd < 0 || fstat(fd, &sb) || !trustedCache(fn, &sb) || sb.st_size == 0)
+	goto exit;
+
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+	cacheReader r { (const char *)map, (const char *)map + sb.st_size };
+	std::vector<std::tuple<uint32_t,std::string_view,std::string_view,
+			       std::string_view,bool>> defs;
+	std::string_view magic, ckey;
+	uint32_t ndefs = 0;
+
+	if (!(r.get(&magic) && magic == std::string_view(MACROCACHE_MAGIC,
+					    sizeof(MACROCACHE_MAGIC) - 1)))
+	    goto exit;
+	if (!(r.get(&ckey) && ckey == key && r.get(&ndefs)))
+	    goto exit;
+
+	/* Validate all of it before defining anything */
+	for (uint32_t i = 0; i < ndefs; i++) {
+	    uint32_t flags, olen;
+	    std::string_view name, opts, body;
+	    bool hasopts = true;
+	    if (!(r.get(&flags) && r.get(&name)))
+		goto exit;
+	    /* Peek at the options length for the no-options marker */
+	    if (!r.get(&olen))
+		goto exit;
+	    if (olen == UINT32_MAX) {
+		hasopts = false;
+	    } else {
+		r.p -= sizeof(olen);
+		if (!r.get(&opts))
+		    goto exit;
+	    }
+	    if (!r.get(&body))
+		goto exit;
+	    defs.push_back({flags, name, opts, body, hasopts});
+	}
+	if (r.p != r.end)
+	    goto exit;
+
+	for (auto const & [flags, name, opts, body, hasopts] : defs) {
+	    string o(opts);
+	    pushMacro(mc, string(name), hasopts ? o.c_str() : NULL,
+		      string(body), RMIL_MACROFILES, flags);
+	}
+	rpmlog(RPMLOG_DEBUG, "loaded %u macros from cache %s\n", ndefs, fn);
+	rc = 0;
+    }
+
+exit:
+    if (map != MAP_FAILED)
+	munmap(map, sb.st_size);
+    if (fd >= 0)
+	close(fd);
+    return rc;
+}
+
+static void putCacheStr(FILE *f, std::string_view s)
+{
+    uint32_t len = s.size();
+    fwrite(&len, sizeof(len), 1, f);
+    fwrite(s.data(), 1, len, f);
+}
+
+static void saveMacroCache(const char *fn, const string & key,
+			   const std::vector<macroDef> & defs)
+{
+    string tmpfn = string(fn) + ".XXXXXX";
+    int fd = mkstemp(tmpfn.data());
+    FILE *f = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    uint32_t ndefs = defs.size();
+    int rc = -1;
+
+    if (f == NULL)
+	goto exit;
+
+    putCacheStr(f, std::string_view(MACROCACHE_MAGIC,
+				    sizeof(MACROCACHE_MAGIC) - 1));
+    putCacheStr(f, key);
+    fwrite(&ndefs, sizeof(ndefs), 1, f);
+    for (auto const & def : defs) {
+	uint32_t flags = def.flags;
+	fwrite(&flags, sizeof(flags), 1, f);
+	putCacheStr(f, def.name);
+	if (def.hasopts) {
+	    putCacheStr(f, def.opts);
+	} else {
+	    uint32_t none = UINT32_MAX;
+	    fwrite(&none, sizeof(none), 1, f);
+	}
+	putCacheStr(f, def.body);
+    }
+
+    rc = ferror(f);
+    if (fclose(f) || rc)
+	rc = -1;
+    else
+	rc = rename(tmpfn.c_str(), fn);
+
+exit:
+    if (rc) {
+	rpmlog(RPMLOG_DEBUG, "failed to write macro cache %s: %s\n",
+		fn, strerror(errno));
+	if (f == NULL && fd >= 0)
+	    close(fd);
+	if (fd >= 0)
+	    unlink(tmpfn.c_str());
+    }
+}
+
 static void copyMacros(rpmMacroContext src, rpmMacroContext dst, int level)
 {
     for (auto const & entry : src->tab) {
@@ -2095,6 +2332,7 @@ rpmMacroContext_s::rpmMacroContext_s()
 void macros::clear()
 {
     mc->tab.clear();
+    mc->scoped.clear();
     initBuiltins(mc);
 }
 
@@ -2120,9 +2358,20 @@ int macros::undefine(const std::string & n)
 void macros::dump(FILE *fp)
 {
     if (fp == NULL) fp = stderr;
+    std::vector<rpmMacroEntry> entries;
+
+    /* The table is unordered, dump in alphabetical order */
+    entries.reserve(mc->tab.size());
+    for (auto & entry : mc->tab)
+	entries.push_back(&entry.second.top());
+    std::sort(entries.begin(), entries.end(),
+	      [](rpmMacroEntry a, rpmMacroEntry b) {
+		return strcmp(a->name, b->name) < 0;
+	      });
+
     fprintf(fp, "========================\n");
-    for (auto & entry : mc->tab) {
-	auto const & me = entry.second.top();
+    for (auto mep : entries) {
+	auto const & me = *mep;
 	fprintf(fp, "%3d%c %s", me.level,
 		    ((me.flags & ME_USED) ? '=' : ':'), me.name);
 	if (me.opts && *me.opts)
@@ -2200,6 +2449,7 @@ macros::expand_numeric(const std::initializer_list<std::string> & src, int flags
 
 void macros::init(const std::string & macrofiles)
 {
+    std::vector<string> paths;
     ARGV_t pattern, globs = NULL;
     argvSplit(&globs, macrofiles.c_str(), ":");
     for (pattern = globs; pattern && *pattern; pattern++) {
@@ -2210,7 +2460,6 @@ void macros::init(const std::string & macrofiles)
 	    continue;
 	}
 
-	/* Read macros from each file. */
 	for (path = files; *path; path++) {
 	    size_t len = strlen(*path);
 	    if (rpmFileHasSuffix(*path, ".rpmnew") ||
@@ -2219,12 +2468,32 @@ void macros::init(const std::string & macrofiles)
 		(len > 0 && !risalnum((*path)[len - 1]))) {
 		continue;
 	    }
-	    (void) loadMacroFile(mc, *path);
+	    paths.push_back(*path);
 	}
 	argvFree(files);
     }
     argvFree(globs);
 
+    /* Use the macro cache if enabled and up to date with the files */
+    const char *cachefn = secure_getenv("RPM_MACROCACHE");
+    string key;
+    if (cachefn && *cachefn)
+	key = macroCacheKey(macrofiles, paths);
+
+    if (key.empty() || loadMacroCache(mc, cachefn, key)) {
+	std::vector<macroDef> defs;
+	int nfailed = 0;
+
+	/* Read macros from each file. */
+	for (auto const & path : paths) {
+	    if (loadMacroFile(mc, path, key.empty() ? NULL : &defs))
+		nfailed++;
+	}
+
+	if (!key.empty() && nfailed == 0)
+	    saveMacroCache(cachefn, key, defs);
+    }
+
     /* Reload cmdline macros */
     macros cli(rpmCLIMacroContext);
     copyMacros(cli.mc, mc, RMIL_CMDLINE);
@@ -13,6 +13,9 @@
 #include <fcntl.h>
 #include <sys/resource.h>
 #include <atomic>
+#ifdef ENABLE_OPENMP
+#include <omp.h>
+#endif
 
 #include <rpm/rpmlog.h>
 #include <rpm/rpmmacro.h>
@@ -151,7 +154,6 @@ struct FDIO_s {
  * Update digest(s) attached to fd.
  */
 static void fdUpdateDigests(FD_t fd, const void * buf, size_t buflen);
-static FD_t fdNew(int fdno, const char *descr);
 /**
  */
 int _rpmio_debug = 0;
@@ -337,7 +339,7 @@ FD_t fdFree( FD_t fd)
     return NULL;
 }
 
-static FD_t fdNew(int fdno, const char *descr)
+FD_t fdNew(int fdno, const char *descr)
 {
     FD_t fd = new FD_s {};
     fd->nrefs = 0;
@@ -526,6 +528,22 @@ static int parsethreadn(const char *s, char **end)
     return threads;
 }
 
+/*
+ * Number of threads for decompression when not explicitly given in the
+ * mode string: 0 disables, -1 means autodetection.
+ */
+static int decodethreadn(void)
+{
+    int threads = rpmExpandNumeric("%{?_payload_decompress_nthreads}");
+    if (threads < 0) {
+	threads = 0;
+	if (!omp_in_parallel())
+	    threads = rpmExpandNumeric("%{getncpus:thread}");
+    }
+
+    return threads;
+}
+
 static const struct FDIO_s ufdio_s = {
   "ufdio", NULL,
   fdRead, fdWrite, fdSeek, fdClose,
@@ -758,7 +776,7 @@ static LZFILE *lzopen_internal(const char *mode, int fd, int xz)
     lzma_ret ret;
     lzma_stream init_strm = LZMA_STREAM_INIT;
     uint64_t mem_limit = rpmExpandNumeric("%{_xz_memlimit}");
-    unsigned int threads = 0;
+    int threads = -1;
 
     for (; *mode; mode++) {
 	if (*mode == 'w')
@@ -781,6 +799,8 @@ static LZFILE *lzopen_internal(const char *mode, int fd, int xz)
     lzfile->encoding = encoding;
     lzfile->eof = 0;
     lzfile->strm = init_strm;
+    if (threads < 0)
+	threads = encoding ? 0 : decodethreadn();
     if (encoding) {
 	if (xz) {
 	    if (!threads) {
@@ -788,7 +808,7 @@ static LZFILE *lzopen_internal(const char *mode, int fd, int xz)
 	    } else {
 		lzma_mt mt_options = {
 		    .flags = 0,
-		    .threads = threads,
+		    .threads = (uint32_t)threads,
 		    .block_size = 0,
 		    .timeout = 0,
 		    .preset = level,
@@ -803,7 +823,23 @@ static LZFILE *lzopen_internal(const char *mode, int fd, int xz)
 	    ret = lzma_alone_encoder(&lzfile->strm, &options);
 	}
     } else {   /* lzma_easy_decoder_memusage(level) is not ready yet, use hardcoded limit for now */
-	ret = lzma_auto_decoder(&lzfile->strm, mem_limit ? mem_limit : 100<<20, 0);
+	if (!mem_limit)
+	    mem_limit = 100<<20;
+#if LZMA_VERSION >= 50040002
+	/* Only multi-block streams with sizes in block headers actually
+	 * get decoded in parallel, others fall back to a single thread. */
+	if (xz && threads > 1) {
+	    lzma_mt mt_options = {
+		.flags = 0,
+		.threads = (uint32_t)threads,
+		.timeout = 0,
+		.memlimit_threading = mem_limit,
+		.memlimit_stop = mem_limit };
+
+	    ret = lzma_stream_decoder_mt(&lzfile->strm, &mt_options);
+	} else
+#endif
+	ret = lzma_auto_decoder(&lzfile->strm, mem_limit, 0);
     }
     if (ret != LZMA_OK) {
 	switch (ret) {
@@ -1003,10 +1039,16 @@ const FDIO_t lzdio = &lzdio_s;
 
 #include <zstd.h>
 
+#define ZSTD_MAXFRAMESIZE	(64 << 20)	/* max. frame size (F flag) */
+#define ZSTD_MAXBATCHSIZE	(256 << 20)	/* max. parallel decode batch */
+#define ZSTD_READAHEAD		(1 << 20)	/* compressed input read size */
+
 typedef struct rpmzstd_s {
     int flags;			/*!< open flags. */
     int fdno;
     int level;			/*!< compression level */
+    int threads;		/*!< frame-parallel decoding threads */
+    size_t framesize;		/*!< uncompressed size of independent frames */
     FILE * fp;
     union {
 	ZSTD_DStream *d;
@@ -1015,6 +1057,11 @@ typedef struct rpmzstd_s {
     std::vector<uint8_t> b;
     ZSTD_inBuffer zib;          /*!< ZSTD_inBuffer */
     ZSTD_outBuffer zob;         /*!< ZSTD_outBuffer */
+    std::vector<uint8_t> fb;	/*!< uncompressed frame data */
+    size_t fbpos;		/*!< read position in frame data */
+    std::vector<uint8_t> ib;	/*!< compressed frames for parallel decode */
+    size_t ibpos;		/*!< read position in compressed frames */
+    unsigned int nframes;	/*!< number of frames written */
 } * rpmzstd;
 
 static rpmzstd rpmzstdNew(int fdno, const char *fmode)
@@ -1027,9 +1074,10 @@ static rpmzstd rpmzstdNew(int fdno, const char *fmode)
     char *t = stdio;
     char *te = t + sizeof(stdio) - 2;
     int c;
-    int threads = 0;
+    int threads = -1;
     int windowlog = 27;
     int longdist = 0;
+    int framesize = 0;
 
     switch ((c = *s++)) {
     case 'a':
@@ -1061,6 +1109,13 @@ static rpmzstd rpmzstdNew(int fdno, const char *fmode)
 	case 'T':
 	    threads = parsethreadn(s, (char **)&s);
 	    continue;
+	case 'F':
+	    framesize = strtol(s, (char **)&s, 10);
+	    if (framesize < 1 || framesize > (ZSTD_MAXFRAMESIZE >> 20)) {
+		framesize = (framesize < 1) ? 1 : (ZSTD_MAXFRAMESIZE >> 20);
+		rpmlog(RPMLOG_WARNING, "Invalid frame size for zstd. Using %i instead.\n", framesize);
+	    }
+	    continue;
     case 'L':
 	    c = *s++;
 	    longdist = 1;
@@ -1109,6 +1164,8 @@ static rpmzstd rpmzstdNew(int fdno, const char *fmode)
 	    goto err;
 	}
 	nb = ZSTD_DStreamInSize();
+	if (threads < 0)
+	    threads = decodethreadn();
     } else {					/* compressing */
 	if ((zstd->stream.c = ZSTD_createCCtx()) == NULL
 	 || ZSTD_isError(ZSTD_CCtx_setParameter(zstd->stream.c, ZSTD_c_compressionLevel, level))) {
@@ -1133,6 +1190,8 @@ static rpmzstd rpmzstdNew(int fdno, const char *fmode)
     zstd->flags = flags;
     zstd->fdno = fdno;
     zstd->level = level;
+    zstd->threads = threads;
+    zstd->framesize = (size_t)framesize << 20;
     zstd->fp = fp;
     zstd->b.resize(nb);
 
@@ -1164,6 +1223,144 @@ static FD_t zstdFdopen(FD_t fd, int fdno, const char * fmode)
     return fd;
 }
 
+/* Compress buffered data into a frame of its own, with content size */
+static int zstdWriteFrame(FDSTACK_t fps, rpmzstd zstd)
+{
+    ZSTD_inBuffer zib = { zstd->fb.data(), zstd->fb.size(), 0 };
+    size_t xx = ZSTD_CCtx_setPledgedSrcSize(zstd->stream.c, zib.size);
+
+    if (ZSTD_isError(xx)) {
+	fps->errcookie = ZSTD_getErrorName(xx);
+	return -1;
+    }
+
+    do {
+	zstd->zob.dst  = zstd->b.data();
+	zstd->zob.size = zstd->b.size();
+	zstd->zob.pos  = 0;
+	xx = ZSTD_compressStream2(zstd->stream.c, &zstd->zob, &zib, ZSTD_e_end);
+	if (ZSTD_isError(xx)) {
+	    fps->errcookie = ZSTD_getErrorName(xx);
+	    return -1;
+	}
+	if (zstd->zob.pos != fwrite(zstd->b.data(), 1, zstd->zob.pos, zstd->fp)) {
+	    fps->errcookie = "zstdWriteFrame fwrite failed.";
+	    return -1;
+	}
+    } while (xx != 0);
+
+    zstd->fb.clear();
+    zstd->nframes++;
+    return 0;
+}
+
+/* Read more compressed data for parallel decoding, return bytes read */
+static size_t zstdReadAhead(rpmzstd zstd)
+{
+    size_t n = zstd->ib.size();
+    zstd->ib.resize(n + ZSTD_READAHEAD);
+    size_t nr = fread(zstd->ib.data() + n, 1, ZSTD_READAHEAD, zstd->fp);
+    zstd->ib.resize(n + nr);
+    return nr;
+}
+
+/*
+ * Decode a batch of consecutive frames in parallel into the frame buffer.
+ * Only frames recording their content size can be decoded this way, on
+ * the first one that does not, switch over to streaming decompression for
+ * the rest of the file. Returns the number of frames decoded, 0 on EOF or
+ * switch-over and -1 on error.
+ */
+static int zstdDecodeFrames(FDSTACK_t fps, rpmzstd zstd)
+{
+    std::vector<size_t> csize, coff, dsize, doff, ret;
+    size_t off, total = 0;
+
+    zstd->ib.erase(zstd->ib.begin(), zstd->ib.begin() + zstd->ibpos);
+    zstd->ibpos = 0;
+    zstd->fb.clear();
+    zstd->fbpos = 0;
+
+    for (off = 0; csize.size() < (size_t)zstd->threads; off += csize.back()) {
+	if (zstd->ib.size() - off < ZSTD_READAHEAD)
+	    zstdReadAhead(zstd);
+	if (zstd->ib.size() == off)
+	    break;
+
+	unsigned long long fsize = ZSTD_getFrameContentSize(zstd->ib.data() + off,
+						    zstd->ib.size() - off);
+	if (fsize == ZSTD_CONTENTSIZE_UNKNOWN || fsize == ZSTD_CONTENTSIZE_ERROR ||
+	    fsize > ZSTD_MAXFRAMESIZE || total + fsize > ZSTD_MAXBATCHSIZE) {
+	    if (csize.empty())
+		zstd->threads = 0;
+	    break;
+	}
+
+	size_t xx;
+	while (ZSTD_isError(xx = ZSTD_findFrameCompressedSize(zstd->ib.data() + off,
+						    zstd->ib.size() - off))) {
+	    if (zstdReadAhead(zstd) == 0) {
+		fps->errcookie = ZSTD_getErrorName(xx);
+		return -1;
+	    }
+	}
+	coff.push_back(off);
+	csize.push_back(xx);
+	doff.push_back(total);
+	dsize.push_back(fsize);
+	total += fsize;
+    }
+
+    /* Let the streaming decoder pick up from the first unhandled frame */
+    if (zstd->threads == 0) {
+	zstd->zib.src  = zstd->ib.data();
+	zstd->zib.size = zstd->ib.size();
+	zstd->zib.pos  = 0;
+	return 0;
+    }
+
+    zstd->fb.resize(total);
+    ret.resize(csize.size());
+    int nframes = csize.size();
+    int nthreads = zstd->threads;
+#ifdef ENABLE_OPENMP
+    /*
+     * The payload can be read from within a parallel region, such as the
+     * one writing out files on install. Nested regions are off by default
+     * and would run on a single thread, so allow one more level for the
+     * duration, sharing the threads with the enclosing team.
+     */
+    int levels = omp_get_max_active_levels();
+    if (omp_in_parallel()) {
+	int active = omp_get_active_level();
+	if (levels <= active)
+	    omp_set_max_active_levels(active + 1);
+	nthreads /= omp_get_num_threads();
+	if (nthreads < 2)
+	    nthreads = 2;
+    }
+#endif
+    #pragma omp parallel for num_threads(nthreads) if (nframes > 1)
+    for (int i = 0; i < nframes; i++) {
+	ret[i] = ZSTD_decompress(zstd->fb.data() + doff[i], dsize[i],
+				 zstd->ib.data() + coff[i], csize[i]);
+    }
+#ifdef ENABLE_OPENMP
+    omp_set_max_active_levels(levels);
+#endif
+
+    for (int i = 0; i < nframes; i++) {
+	if (ZSTD_isError(ret[i]) || ret[i] != dsize[i]) {
+	    fps->errcookie = ZSTD_isError(ret[i]) ?
+			ZSTD_getErrorName(ret[i]) : "zstd frame size mismatch";
+	    return -1;
+	}
+    }
+    zstd->ibpos = off;
+
+    return nframes;
+}
+
 static int zstdFlush(FDSTACK_t fps)
 {
     rpmzstd zstd = zstdFp(fps);
@@ -1172,6 +1369,8 @@ assert(zstd);
 
     if ((zstd->flags & O_ACCMODE) == O_RDONLY) { /* decompressing */
 	rc = 0;
+    } else if (zstd->framesize) {		/* compressing frames */
+	rc = zstd->fb.empty() ? 0 : zstdWriteFrame(fps, zstd);
     } else {					/* compressing */
 	/* close frame */
 	int xx;
@@ -1202,6 +1401,24 @@ static ssize_t zstdRead(FDSTACK_t fps, void * buf, size_t count)
 assert(zstd);
     ZSTD_outBuffer zob = { buf, count, 0 };
 
+    /* Hand out frames decoded in parallel while possible. */
+    while (zstd->threads > 1 && zob.pos < zob.size) {
+	if (zstd->fbpos == zstd->fb.size()) {
+	    int nd = zstdDecodeFrames(fps, zstd);
+	    if (nd < 0)
+		return -1;
+	    if (nd == 0 && zstd->threads)
+		return zob.pos;		/* EOF */
+	    continue;
+	}
+	size_t n = zstd->fb.size() - zstd->fbpos;
+	if (n > zob.size - zob.pos)
+	    n = zob.size - zob.pos;
+	memcpy((uint8_t *)zob.dst + zob.pos, zstd->fb.data() + zstd->fbpos, n);
+	zstd->fbpos += n;
+	zob.pos += n;
+    }
+
     while (zob.pos < zob.size) {
 	/* Re-fill compressed data buffer. */
 	if (zstd->zib.pos >= zstd->zib.size) {
@@ -1228,6 +1445,18 @@ static ssize_t zstdWrite(FDSTACK_t fps, const void * buf, size_t count)
 assert(zstd);
     ZSTD_inBuffer zib = { buf, count, 0 };
 
+    /* Cut the data into independent frames if requested. */
+    while (zstd->framesize && zib.pos < zib.size) {
+	size_t n = zstd->framesize - zstd->fb.size();
+	if (n > zib.size - zib.pos)
+	    n = zib.size - zib.pos;
+	zstd->fb.insert(zstd->fb.end(), (const uint8_t *)buf + zib.pos,
+			(const uint8_t *)buf + zib.pos + n);
+	zib.pos += n;
+	if (zstd->fb.size() == zstd->framesize && zstdWriteFrame(fps, zstd))
+	    return -1;
+    }
+
     while (zib.pos < zib.size) {
 
 	/* Reset to beginning of compressed data buffer. */
@@ -1263,6 +1492,12 @@ assert(zstd);
     if ((zstd->flags & O_ACCMODE) == O_RDONLY) { /* decompressing */
 	rc = 0;
 	ZSTD_freeDStream(zstd->stream.d);
+    } else if (zstd->framesize) {		/* compressing frames */
+	if (zstd->fb.empty() && zstd->nframes)
+	    rc = 0;
+	else
+	    rc = zstdWriteFrame(fps, zstd);
+	ZSTD_freeCCtx(zstd->stream.c);
     } else {					/* compressing */
 	/* close frame */
 	int xx;
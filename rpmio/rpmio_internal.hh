@@ -27,6 +27,15 @@ void fdFiniDigest(FD_t fd, int id,
 
 DIGEST_CTX fdDupDigest(FD_t fd, int id);
 
+/** \ingroup rpmio
+ * Create a fd for an already open file descriptor, taking ownership of it.
+ * Unlike fdDup(), this preserves the descriptor flags (eg O_CLOEXEC).
+ * @param fdno		file descriptor
+ * @param descr		description for diagnostics (or NULL)
+ * @return		new fd
+ */
+FD_t fdNew(int fdno, const char *descr);
+
 /**
  * Read an entire file into a buffer.
  * @param fn		file name to read
@@ -3,6 +3,7 @@
  */
 
 #include "system.h"
+#include <time.h>
 #include <rpm/rpmsw.h>
 #include "debug.h"
 
@@ -18,8 +19,12 @@ rpmsw rpmswNow(rpmsw sw)
 	(void) rpmswInit();
     if (sw == NULL)
 	return NULL;
-    if (gettimeofday(&sw->u.tv, NULL))
+    /* Use a monotonic clock, wall clock adjustments would skew the timings */
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts))
     	return NULL;
+    sw->u.tv.tv_sec = ts.tv_sec;
+    sw->u.tv.tv_usec = ts.tv_nsec / 1000;
     return sw;
 }
 
@@ -0,0 +1,297 @@
+#!/usr/bin/python3
+#
+# Benchmark the hot paths of rpm on synthetic packages and report the
+# timings as JSON. Everything happens in a temporary directory: the
+# packages are built into a private topdir and installed into a private
+# --root, no network access or system changes are involved.
+
+import argparse
+import json
+import os
+import platform
+import random
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+import rpm
+
+def preamble(name, summary):
+    return '\n'.join([
+        'Name: %s' % name,
+        'Version: 1.0',
+        'Release: 1',
+        'License: GPL',
+        'Summary: %s' % summary,
+        'BuildArch: noarch',
+        '',
+        '%description',
+        '%{summary}',
+        '',
+    ])
+
+def spec_tiny(scale):
+    ndirs = 100
+    nfiles = 100 * scale
+    spec = preamble('bench-tiny', 'Many tiny files')
+    spec += '''
+%%install
+for d in $(seq 1 %d); do
+    mkdir -p ${RPM_BUILD_ROOT}/opt/%%{name}/d${d}
+    for f in $(seq 1 %d); do
+        echo "${d} ${f}" > ${RPM_BUILD_ROOT}/opt/%%{name}/d${d}/f${f}
+    done
+done
+
+%%files
+/opt/%%{name}
+''' % (ndirs, nfiles)
+    return spec, ndirs * nfiles
+
+def spec_huge(scale):
+    nfiles = 4
+    size = 16 * 1024 * 1024 * scale
+    spec = preamble('bench-huge', 'Few huge files')
+    spec += '''
+%%install
+mkdir -p ${RPM_BUILD_ROOT}/opt/%%{name}
+for f in $(seq 1 %d); do
+    head -c %d /dev/urandom > ${RPM_BUILD_ROOT}/opt/%%{name}/f${f}
+done
+
+%%files
+/opt/%%{name}
+''' % (nfiles, size)
+    return spec, nfiles
+
+def spec_deep(scale):
+    nbranches = 50 * scale
+    depth = 32
+    nfiles = 2
+    spec = preamble('bench-deep', 'Deep directory trees')
+    spec += '''
+%%install
+for b in $(seq 1 %d); do
+    d=${RPM_BUILD_ROOT}/opt/%%{name}/b${b}
+    for l in $(seq 1 %d); do
+        d=${d}/l${l}
+        mkdir -p ${d}
+        for f in $(seq 1 %d); do
+            echo "${b} ${l} ${f}" > ${d}/f${f}
+        done
+    done
+done
+
+%%files
+/opt/%%{name}
+''' % (nbranches, depth, nfiles)
+    return spec, nbranches * depth * nfiles
+
+def spec_deps(scale):
+    npkgs = 200 * scale
+    nprovs = 20
+    nreqs = 10
+    # Fixed seed for a reproducible dependency graph. Packages only require
+    # capabilities of packages with a lower number, so there are no loops.
+    rnd = random.Random(npkgs)
+    spec = preamble('bench-deps', 'Heavy dependencies')
+    spec += '''
+%%install
+mkdir -p ${RPM_BUILD_ROOT}/opt/%%{name}
+for p in $(seq 0 %d); do
+    touch ${RPM_BUILD_ROOT}/opt/%%{name}/p${p}
+done
+''' % (npkgs - 1)
+    for i in range(npkgs):
+        spec += '\n%%package -n bench-dep%d\nSummary: %%{summary}\n' % i
+        for j in range(nprovs):
+            spec += 'Provides: bench-cap%d-%d = %d\n' % (i, j, j)
+        for n in range(min(i, nreqs)):
+            k = rnd.randrange(i)
+            j = rnd.randrange(nprovs)
+            spec += 'Requires: bench-cap%d-%d >= %d\n' % (k, j, j)
+        if i:
+            spec += 'Requires: /opt/%%{name}/p%d\n' % rnd.randrange(i)
+        spec += '\n%%description -n bench-dep%d\n%%{summary}\n' % i
+        spec += '\n%%files -n bench-dep%d\n/opt/%%{name}/p%d\n' % (i, i)
+    return spec, npkgs
+
+SCENARIOS = {
+    'tiny': spec_tiny,
+    'huge': spec_huge,
+    'deep': spec_deep,
+    'deps': spec_deps,
+}
+
+def bench_expand(scale, repeat):
+    # Macro expansion throughput, in-process on a large macro table
+    nmacros = 5000 * scale
+    nexpand = 2000 * scale
+    names = ['bench_m%d' % i for i in range(nmacros)]
+    for i, n in enumerate(names):
+        rpm.addMacro(n, 'v%d' % i)
+    rpm.expandMacro('%define bench_p(a:) %{-a*}%{1}%{?bench_m0}')
+    src = ' '.join('%%{%s}' % n for n in names[:100])
+    src += ' %{bench_p -a x y} %{?bench_undefined} %{expr:1+1}'
+
+    runs = []
+    try:
+        for i in range(repeat):
+            print('expand: iteration %d/%d' % (i + 1, repeat), file=sys.stderr)
+            start = time.perf_counter()
+            for j in range(nexpand):
+                rpm.expandMacro(src)
+            runs.append(time.perf_counter() - start)
+    finally:
+        rpm.delMacro('bench_p')
+        for n in names:
+            rpm.delMacro(n)
+
+    return {
+        'macros': nmacros,
+        'expansions': nexpand,
+        'timings': {'expand': summary(runs)},
+        'rate': nexpand / statistics.median(runs),
+    }
+
+MICRO = {
+    'expand': bench_expand,
+}
+
+class Bench:
+    def __init__(self, tmpdir, payload):
+        self.topdir = os.path.join(tmpdir, 'build')
+        self.root = os.path.join(tmpdir, 'root')
+        self.buildopts = [
+            '--define', '_topdir %s' % self.topdir,
+            '--define', '_binary_payload %s' % payload,
+        ]
+        self.rootopts = ['--root', self.root]
+
+    def run(self, cmd, check=True):
+        start = time.perf_counter()
+        subprocess.run(cmd, check=check, stdin=subprocess.DEVNULL,
+                       stdout=subprocess.DEVNULL)
+        return time.perf_counter() - start
+
+    def build(self, specfile):
+        shutil.rmtree(self.topdir, ignore_errors=True)
+        t = self.run(['rpmbuild', '-bb', '--quiet'] + self.buildopts +
+                     [specfile])
+        rpmdir = os.path.join(self.topdir, 'RPMS', 'noarch')
+        pkgs = [os.path.join(rpmdir, p) for p in sorted(os.listdir(rpmdir))]
+        return t, pkgs
+
+    def reset(self):
+        shutil.rmtree(self.root, ignore_errors=True)
+        os.makedirs(self.root)
+        subprocess.run(['rpmdb', '--initdb'] + self.rootopts, check=True)
+
+    def depsolve(self, pkgs):
+        ts = rpm.TransactionSet(self.root)
+        for p in pkgs:
+            with open(p, 'rb') as f:
+                ts.addInstall(ts.hdrFromFdno(f.fileno()), p, 'i')
+        start = time.perf_counter()
+        probs = ts.check()
+        tcheck = time.perf_counter() - start
+        if probs:
+            raise RuntimeError('unresolved dependencies: %s' % probs)
+        start = time.perf_counter()
+        ts.order()
+        torder = time.perf_counter() - start
+        ts.closeDB()
+        return tcheck, torder
+
+    def iteration(self, specfile):
+        res = {}
+        res['build'], pkgs = self.build(specfile)
+        res['keys'] = self.run(['rpmkeys', '-K'] + pkgs, check=False)
+        self.reset()
+        res['check'], res['order'] = self.depsolve(pkgs)
+        res['install'] = self.run(['rpm', '-i'] + self.rootopts + pkgs)
+        res['query'] = self.run(['rpm', '-qa'] + self.rootopts)
+        res['verify'] = self.run(['rpm', '-Va'] + self.rootopts, check=False)
+        names = [os.path.basename(p).rsplit('-', 2)[0] for p in pkgs]
+        res['erase'] = self.run(['rpm', '-e'] + self.rootopts + names)
+        return res, pkgs
+
+def summary(runs):
+    return {
+        'min': min(runs),
+        'median': statistics.median(runs),
+        'max': max(runs),
+        'runs': runs,
+    }
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+            description='Benchmark rpm on synthetic packages')
+    parser.add_argument('-s', '--scenario', action='append',
+                        choices=list(SCENARIOS.keys()) + list(MICRO.keys()),
+                        help='scenario to run (default: all)')
+    parser.add_argument('-n', '--repeat', type=int, default=3,
+                        help='number of iterations per scenario')
+    parser.add_argument('-x', '--scale', type=int, default=1,
+                        help='multiply the size of the scenarios')
+    parser.add_argument('-p', '--payload', default='w6.gzdio',
+                        help='payload compression for the packages')
+    parser.add_argument('-o', '--output', default='-',
+                        help='JSON output file (default: stdout)')
+    parser.add_argument('-k', '--keep', action='store_true',
+                        help='keep the temporary directory')
+    args = parser.parse_args()
+
+    tmpdir = tempfile.mkdtemp(prefix='rpmbench.')
+    bench = Bench(tmpdir, args.payload)
+    results = {}
+
+    try:
+        for name in args.scenario or list(SCENARIOS) + list(MICRO):
+            if name in MICRO:
+                results[name] = MICRO[name](args.scale, args.repeat)
+                continue
+
+            spec, nfiles = SCENARIOS[name](args.scale)
+            specfile = os.path.join(tmpdir, 'bench-%s.spec' % name)
+            with open(specfile, 'w') as f:
+                f.write(spec)
+
+            timings = {}
+            for i in range(args.repeat):
+                print('%s: iteration %d/%d' % (name, i + 1, args.repeat),
+                      file=sys.stderr)
+                res, pkgs = bench.iteration(specfile)
+                for op, t in res.items():
+                    timings.setdefault(op, []).append(t)
+
+            results[name] = {
+                'packages': len(pkgs),
+                'files': nfiles,
+                'size': sum(os.path.getsize(p) for p in pkgs),
+                'timings': {op: summary(runs) for op, runs in timings.items()},
+            }
+    finally:
+        if args.keep:
+            print('keeping %s' % tmpdir, file=sys.stderr)
+        else:
+            shutil.rmtree(tmpdir, ignore_errors=True)
+
+    report = {
+        'rpm': rpm.__version__,
+        'machine': platform.machine(),
+        'cpus': os.cpu_count(),
+        'repeat': args.repeat,
+        'scale': args.scale,
+        'payload': args.payload,
+        'results': results,
+    }
+
+    out = sys.stdout if args.output == '-' else open(args.output, 'w')
+    json.dump(report, out, indent=2)
+    out.write('\n')
+    if out is not sys.stdout:
+        out.close()